@@ -17,7 +17,7 @@
  * QUICK START
  * -----------
  * To create your own custom package:
- *   1. Pick an unused Type ID from the table below (use 206+ range)
+ *   1. Pick an unused Type ID from the table below (use 209+ range)
  *   2. Choose a base class: BroadcastPackage (all nodes) or SinglePackage (one
  *      node)
  *   3. Add your data fields with appropriate types
@@ -32,6 +32,9 @@
  *   202 : StatusPackage      (device health and configuration)
  *   204 : MetricsPackage     (network performance metrics)
  *   205 : MpptPackage        (MPPT solar charge controller data)  <-- this file
+ *   206 : SensorBatchPackage (batched sensor samples, alteriom_sensor_batch.hpp)
+ *   207 : StatusDeltaPackage (changed status fields, alteriom_status_delta.hpp)
+ *   208 : StatusRequestPackage (asks a node for a status snapshot)
  *   400 : CommandPackage     (device control commands)
  *   600 : MeshNodeListPackage
  *   601 : MeshTopologyPackage
@@ -44,7 +47,7 @@
  *   612 : BridgeTakeoverPackage
  *   614 : NTPTimeSyncPackage
  *
- * Available ranges: 206-399 (add your package here and update this table).
+ * Available ranges: 209-399 (add your package here and update this table).
  *
  *
  * CHOOSING BASE CLASS
@@ -0,0 +1,280 @@
+#ifndef ALTERIOM_SENSOR_BATCH_HPP
+#define ALTERIOM_SENSOR_BATCH_HPP
+
+#include <vector>
+
+#include "painlessmesh/base64.hpp"
+#include "painlessmesh/plugin.hpp"
+
+/**
+ * @file alteriom_sensor_batch.hpp
+ * @brief Many sensor samples in one compact package
+ *
+ * SensorPackage sends one reading per message, as JSON with a full header.
+ * Nodes that sample faster than they upload (e.g. 10 Hz sampling, 1 Hz
+ * upload) can collect their samples with SensorBatchEncoder and send them
+ * as a single SensorBatchPackage instead.
+ *
+ * ENCODING
+ * ========
+ *
+ * Values are stored as fixed point numbers (SENSOR_BATCH_SCALE, i.e. 0.01 °C,
+ * 0.01 % and 0.01 hPa). Every sample is stored as the difference to the
+ * previous one, so slowly changing values take a single byte:
+ *
+ *   version (1 byte, SENSOR_BATCH_VERSION)
+ *   per sample:
+ *     time offset to previous sample in ms (varint)
+ *     temperature delta (zigzag varint)
+ *     humidity delta    (zigzag varint)
+ *     pressure delta    (zigzag varint)
+ *
+ * The first sample is stored relative to zero, with time offset 0. Varints
+ * hold 7 bits per byte, least significant first, with the high bit set on
+ * all but the last byte. Zigzag maps signed to unsigned numbers so that small
+ * negative numbers stay small (0, -1, 1, -2 -> 0, 1, 2, 3).
+ *
+ * The binary data is base64 encoded, because mesh messages are JSON.
+ *
+ * SIZE
+ * ====
+ *
+ * A single SensorPackage takes about 140 bytes on the wire. Samples of a
+ * slowly changing sensor at 10 Hz take about 4 bytes each in a batch (5.5
+ * after base64), plus about 115 bytes per package. A batch of 10 samples is
+ * about 175 bytes (17.5 per sample), a batch of 50 about 390 bytes (7.8 per
+ * sample).
+ */
+
+#ifndef SENSOR_BATCH_MAX_SAMPLES
+#define SENSOR_BATCH_MAX_SAMPLES 64
+#endif
+
+namespace alteriom {
+
+static const uint8_t SENSOR_BATCH_VERSION = 1;
+static const int32_t SENSOR_BATCH_SCALE = 100;  // Fixed point: 0.01 units
+
+/**
+ * @brief One sample of a batch
+ */
+struct SensorSample {
+  uint32_t offsetMs = 0;     // Time since the first sample of the batch
+  double temperature = 0.0;  // Celsius
+  double humidity = 0.0;     // Relative humidity percentage
+  double pressure = 0.0;     // hPa
+};
+
+namespace batch {
+
+inline uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+inline void putVarint(std::vector<uint8_t>& out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+/**
+ * Read a varint
+ *
+ * \return false if the data ends before the varint does
+ */
+inline bool getVarint(const uint8_t*& data, const uint8_t* end,
+                      uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35 && data < end; shift += 7) {
+    uint8_t byte = *data++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+inline int32_t toFixed(double value) {
+  return (int32_t)(value * SENSOR_BATCH_SCALE + (value < 0 ? -0.5 : 0.5));
+}
+
+}  // namespace batch
+
+/**
+ * @brief Collects samples in the compact batch encoding
+ *
+ * \code
+ * SensorBatchEncoder encoder;
+ * // Every 100 ms
+ * encoder.add(millis(), temperature, humidity, pressure);
+ * // Every second
+ * SensorBatchPackage pkg;
+ * pkg.from = mesh.getNodeId();
+ * pkg.take(encoder, timeClient.getEpochTime());
+ * mesh.sendPackage(&pkg);
+ * \endcode
+ */
+class SensorBatchEncoder {
+ public:
+  /**
+   * Add a sample
+   *
+   * \param timeMs Time of the sample in ms, e.g. millis()
+   * \return false if the batch is full (SENSOR_BATCH_MAX_SAMPLES)
+   */
+  bool add(uint32_t timeMs, double temperature, double humidity,
+           double pressure) {
+    if (count >= SENSOR_BATCH_MAX_SAMPLES) return false;
+    if (count == 0) {
+      data.clear();
+      data.push_back(SENSOR_BATCH_VERSION);
+      lastTime = timeMs;
+      last[0] = last[1] = last[2] = 0;
+    }
+    batch::putVarint(data, timeMs - lastTime);
+    lastTime = timeMs;
+    int32_t values[3] = {batch::toFixed(temperature), batch::toFixed(humidity),
+                         batch::toFixed(pressure)};
+    for (int i = 0; i < 3; ++i) {
+      batch::putVarint(data, batch::zigzag(values[i] - last[i]));
+      last[i] = values[i];
+    }
+    ++count;
+    return true;
+  }
+
+  size_t size() const { return count; }
+
+  bool full() const { return count >= SENSOR_BATCH_MAX_SAMPLES; }
+
+  /// The encoded samples (binary, before base64)
+  const std::vector<uint8_t>& bytes() const { return data; }
+
+  void clear() {
+    count = 0;
+    data.clear();
+  }
+
+ protected:
+  size_t count = 0;
+  uint32_t lastTime = 0;
+  int32_t last[3] = {0, 0, 0};
+  std::vector<uint8_t> data;
+};
+
+/**
+ * @brief Decode samples in the compact batch encoding
+ *
+ * @return false if the data is invalid, samples then holds the samples
+ * decoded before the error
+ */
+inline bool decodeSensorBatch(const uint8_t* data, size_t length,
+                              std::vector<SensorSample>& samples) {
+  samples.clear();
+  const uint8_t* end = data + length;
+  if (length == 0 || *data++ != SENSOR_BATCH_VERSION) return false;
+  uint32_t offset = 0;
+  int32_t last[3] = {0, 0, 0};
+  while (data < end) {
+    uint32_t value;
+    if (!batch::getVarint(data, end, value)) return false;
+    offset += value;
+    for (int i = 0; i < 3; ++i) {
+      if (!batch::getVarint(data, end, value)) return false;
+      last[i] += batch::unzigzag(value);
+    }
+    SensorSample sample;
+    sample.offsetMs = offset;
+    sample.temperature = (double)last[0] / SENSOR_BATCH_SCALE;
+    sample.humidity = (double)last[1] / SENSOR_BATCH_SCALE;
+    sample.pressure = (double)last[2] / SENSOR_BATCH_SCALE;
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+/**
+ * @brief Batch of sensor samples in a compact encoding
+ *
+ * Type ID 206 for Alteriom sensor batches. See the top of this file for the
+ * encoding of the data field.
+ */
+class SensorBatchPackage : public painlessmesh::plugin::BroadcastPackage {
+ public:
+  // Unique sensor identifier
+  uint32_t sensorId = 0;
+  // Unix timestamp of the first sample
+  uint32_t timestamp = 0;
+  // Battery level percentage
+  uint8_t batteryLevel = 0;
+  // Number of samples
+  uint16_t count = 0;
+  // Encoded samples, base64
+  TSTRING data = "";
+
+  // MQTT Schema message_type for faster classification
+  uint16_t messageType = 206;  // SENSOR_BATCH
+
+  SensorBatchPackage() : BroadcastPackage(206) {}
+
+  SensorBatchPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj) {
+    sensorId = jsonObj["sid"];
+    timestamp = jsonObj["ts"];
+    batteryLevel = jsonObj["bat"];
+    count = jsonObj["n"];
+    data = jsonObj["data"].as<TSTRING>();
+    messageType = jsonObj["message_type"] | 206;
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = BroadcastPackage::addTo(std::move(jsonObj));
+    jsonObj["sid"] = sensorId;
+    jsonObj["ts"] = timestamp;
+    jsonObj["bat"] = batteryLevel;
+    jsonObj["n"] = count;
+    jsonObj["data"] = data;
+    jsonObj["message_type"] = messageType;
+    return jsonObj;
+  }
+
+  /**
+   * @brief Move the samples of an encoder into this package
+   *
+   * @param encoder Encoder with the samples, cleared afterwards
+   * @param firstTimestamp Unix timestamp of the first sample
+   */
+  void take(SensorBatchEncoder& encoder, uint32_t firstTimestamp) {
+    timestamp = firstTimestamp;
+    count = encoder.size();
+    data = painlessmesh::base64::encode(encoder.bytes().data(),
+                                        encoder.bytes().size());
+    encoder.clear();
+  }
+
+  /**
+   * @brief Decode the samples of this package
+   *
+   * @return false if the data is invalid or doesn't hold count samples
+   */
+  bool samples(std::vector<SensorSample>& result) const {
+    TSTRING raw = painlessmesh::base64::decode(data);
+    return decodeSensorBatch((const uint8_t*)raw.c_str(), raw.length(),
+                             result) &&
+           result.size() == count;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + 6) + data.length();
+  }
+#endif
+};
+
+}  // namespace alteriom
+
+#endif  // ALTERIOM_SENSOR_BATCH_HPP
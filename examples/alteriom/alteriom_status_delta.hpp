@@ -0,0 +1,366 @@
+#ifndef ALTERIOM_STATUS_DELTA_HPP
+#define ALTERIOM_STATUS_DELTA_HPP
+
+#include <map>
+
+#include "alteriom_sensor_package.hpp"
+
+/**
+ * @file alteriom_status_delta.hpp
+ * @brief Send only the StatusPackage fields that changed
+ *
+ * A StatusPackage carries about 30 fields, most of which (organization,
+ * names, location, firmware, configuration) hardly ever change, and takes
+ * about 1 KB on the wire. Sending it in full on every status update makes
+ * status the bulk of the traffic on larger sites.
+ *
+ * Instead a node can keep a StatusDeltaEncoder and broadcast the
+ * StatusDeltaPackage it returns for each update. Most of these only hold the
+ * fields that changed since the previous update, under short keys. Every
+ * STATUS_DELTA_FULL_EVERY updates, and when a receiver asks for it with a
+ * StatusRequestPackage, the package holds all fields instead (a snapshot).
+ *
+ * Receivers (e.g. the gateway) apply the packages with a StatusDeltaDecoder,
+ * which keeps the complete StatusPackage of every node. Every package has a
+ * version, and deltas name the version they apply to. If a receiver missed
+ * one, it asks the node for a snapshot and ignores deltas until it arrives.
+ *
+ * \code
+ * // On the node
+ * StatusDeltaEncoder statusEncoder;
+ * StatusPackage status;  // Kept up to date by the application
+ * auto pkg = statusEncoder.next(status);
+ * mesh.sendPackage(&pkg);
+ *
+ * mesh.onPackage(208, [&](protocol::Variant& variant) {
+ *   statusEncoder.requestFull();
+ *   return true;
+ * });
+ *
+ * // On the gateway
+ * StatusDeltaDecoder statuses;
+ * mesh.onPackage(207, [&](protocol::Variant& variant) {
+ *   auto pkg = variant.to<StatusDeltaPackage>();
+ *   auto result = statuses.apply(pkg);
+ *   if (result == StatusUpdate::NEED_SNAPSHOT) {
+ *     StatusRequestPackage request;
+ *     request.from = mesh.getNodeId();
+ *     request.dest = pkg.from;
+ *     mesh.sendPackage(&request);
+ *   } else if (result == StatusUpdate::SNAPSHOT ||
+ *              result == StatusUpdate::APPLIED) {
+ *     // Only then the decoder has a (changed) status for the node
+ *     publish(*statuses.get(pkg.from));  // Full StatusPackage, e.g. to MQTT
+ *   }
+ *   return true;
+ * });
+ * \endcode
+ *
+ * Deltas are meant for the mesh only and carry no message_type. Gateways
+ * publish the StatusPackage kept by the decoder, in the usual format.
+ */
+
+#ifndef STATUS_DELTA_FULL_EVERY
+#define STATUS_DELTA_FULL_EVERY 20  // Updates between snapshots
+#endif
+
+namespace alteriom {
+
+namespace delta {
+
+/**
+ * Call f(bit, key, a.field, b.field) for every StatusPackage field
+ *
+ * Bits identify the fields in a field mask, keys are used on the wire.
+ */
+template <class A, class B, class F>
+void visitFields(A& a, B& b, F& f) {
+  f(0, "st", a.deviceStatus, b.deviceStatus);
+  f(1, "up", a.uptime, b.uptime);
+  f(2, "mem", a.freeMemory, b.freeMemory);
+  f(3, "wifi", a.wifiStrength, b.wifiStrength);
+  f(4, "fw", a.firmwareVersion, b.firmwareVersion);
+  f(5, "rTo", a.responseToCommand, b.responseToCommand);
+  f(6, "rMsg", a.responseMessage, b.responseMessage);
+  f(7, "org", a.organizationId, b.organizationId);
+  f(8, "cust", a.customerId, b.customerId);
+  f(9, "grp", a.deviceGroup, b.deviceGroup);
+  f(10, "name", a.deviceName, b.deviceName);
+  f(11, "loc", a.deviceLocation, b.deviceLocation);
+  f(12, "sec", a.deviceSecretSet, b.deviceSecretSet);
+  f(13, "rdMs", a.sensorReadInterval, b.sensorReadInterval);
+  f(14, "txMs", a.transmissionInterval, b.transmissionInterval);
+  f(15, "tOff", a.tempOffset, b.tempOffset);
+  f(16, "hOff", a.humidityOffset, b.humidityOffset);
+  f(17, "pOff", a.pressureOffset, b.pressureOffset);
+  f(18, "nSen", a.sensorCount, b.sensorCount);
+  f(19, "sMask", a.sensorTypeMask, b.sensorTypeMask);
+  f(20, "disp", a.displayEnabled, b.displayEnabled);
+  f(21, "brt", a.displayBrightness, b.displayBrightness);
+  f(22, "dspMs", a.displayTimeout, b.displayTimeout);
+  f(23, "slp", a.deepSleepEnabled, b.deepSleepEnabled);
+  f(24, "slpMs", a.deepSleepInterval, b.deepSleepInterval);
+  f(25, "bat", a.batteryPercent, b.batteryPercent);
+  f(26, "mqN", a.mqttMaxRetryAttempts, b.mqttMaxRetryAttempts);
+  f(27, "mqCb", a.mqttCircuitBreakerMs, b.mqttCircuitBreakerMs);
+  f(28, "mqHr", a.mqttHourlyRetryEnabled, b.mqttHourlyRetryEnabled);
+  f(29, "mqIn", a.mqttInitialRetryMs, b.mqttInitialRetryMs);
+  f(30, "mqMax", a.mqttMaxRetryMs, b.mqttMaxRetryMs);
+  f(31, "mqBo", a.mqttBackoffMultiplier, b.mqttBackoffMultiplier);
+}
+
+struct Differ {
+  uint32_t mask = 0;
+  template <typename T>
+  void operator()(uint8_t bit, const char*, const T& a, const T& b) {
+    if (!(a == b)) mask |= 1ul << bit;
+  }
+};
+
+struct Writer {
+  JsonObject obj;
+  uint32_t mask;
+  template <typename T>
+  void operator()(uint8_t bit, const char* key, const T& value, const T&) {
+    if (mask & (1ul << bit)) obj[key] = value;
+  }
+};
+
+struct Reader {
+  JsonObject obj;
+  uint32_t mask = 0;
+  template <typename T>
+  void operator()(uint8_t bit, const char* key, T& value, T&) {
+    JsonVariant field = obj[key];
+    if (field.isNull()) return;
+    value = field.as<T>();
+    mask |= 1ul << bit;
+  }
+};
+
+struct Copier {
+  uint32_t mask;
+  template <typename T>
+  void operator()(uint8_t bit, const char*, T& to, const T& from) {
+    if (mask & (1ul << bit)) to = from;
+  }
+};
+
+/**
+ * Mask of the fields that differ between two statuses
+ */
+inline uint32_t changedFields(const StatusPackage& a, const StatusPackage& b) {
+  Differ differ;
+  visitFields(a, b, differ);
+  return differ.mask;
+}
+
+}  // namespace delta
+
+/**
+ * @brief Changed StatusPackage fields, or all of them (a snapshot)
+ *
+ * Type ID 207 for Alteriom status deltas. Fields are sent under short keys
+ * in "d", see delta::visitFields().
+ */
+class StatusDeltaPackage : public painlessmesh::plugin::BroadcastPackage {
+ public:
+  // Version of the status after this package, counts up from 1
+  uint32_t version = 0;
+  // Version this delta applies to, 0 for a snapshot
+  uint32_t base = 0;
+  // Fields of status that are included (bits of delta::visitFields())
+  uint32_t fields = 0;
+  // Values of the included fields, the others are not used
+  StatusPackage status;
+
+  StatusDeltaPackage() : BroadcastPackage(207) {}
+
+  StatusDeltaPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj) {
+    version = jsonObj["ver"];
+    base = jsonObj["base"] | 0u;
+    delta::Reader reader;
+    reader.obj = jsonObj["d"].as<JsonObject>();
+    delta::visitFields(this->status, this->status, reader);
+    fields = reader.mask;
+    this->status.from = from;
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = BroadcastPackage::addTo(std::move(jsonObj));
+    jsonObj["ver"] = version;
+    if (base != 0) jsonObj["base"] = base;
+    delta::Writer writer;
+#if ARDUINOJSON_VERSION_MAJOR == 7
+    writer.obj = jsonObj["d"].to<JsonObject>();
+#else
+    writer.obj = jsonObj.createNestedObject("d");
+#endif
+    writer.mask = fields;
+    delta::visitFields(this->status, this->status, writer);
+    return jsonObj;
+  }
+
+  bool snapshot() const { return base == 0; }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    size_t size = JSON_OBJECT_SIZE(noJsonFields + 3) + JSON_OBJECT_SIZE(32);
+    const StatusPackage& s = this->status;
+    size += s.firmwareVersion.length() + s.responseMessage.length() +
+            s.organizationId.length() + s.customerId.length() +
+            s.deviceGroup.length() + s.deviceName.length() +
+            s.deviceLocation.length() + 7;
+    return size;
+  }
+#endif
+};
+
+/**
+ * @brief Ask a node for a status snapshot
+ *
+ * Type ID 208, send by receivers that missed a delta.
+ */
+class StatusRequestPackage : public painlessmesh::plugin::SinglePackage {
+ public:
+  StatusRequestPackage() : SinglePackage(208) {}
+
+  StatusRequestPackage(JsonObject jsonObj) : SinglePackage(jsonObj) {}
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    return SinglePackage::addTo(std::move(jsonObj));
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const { return JSON_OBJECT_SIZE(noJsonFields); }
+#endif
+};
+
+/**
+ * @brief Turns status updates of a node into deltas
+ */
+class StatusDeltaEncoder {
+ public:
+  /**
+   * @brief The package to send for the current status
+   *
+   * A snapshot if this is the first update, every STATUS_DELTA_FULL_EVERY
+   * updates or if one was requested, otherwise a delta to the previous one.
+   */
+  StatusDeltaPackage next(const StatusPackage& current) {
+    StatusDeltaPackage pkg;
+    pkg.from = current.from;
+    pkg.base = version;
+    if (++version == 0) ++version;
+    pkg.version = version;
+    if (pkg.base == 0 || fullRequested || sinceFull >= STATUS_DELTA_FULL_EVERY) {
+      // Fields at their default value are left out of snapshots as well
+      pkg.base = 0;
+      pkg.fields = delta::changedFields(StatusPackage(), current);
+      sinceFull = 0;
+      fullRequested = false;
+    } else {
+      pkg.fields = delta::changedFields(last, current);
+      ++sinceFull;
+    }
+    pkg.status = current;
+    last = current;
+    return pkg;
+  }
+
+  /**
+   * @brief Whether anything changed since the last package
+   */
+  bool changed(const StatusPackage& current) const {
+    return version == 0 || fullRequested ||
+           delta::changedFields(last, current) != 0;
+  }
+
+  /**
+   * @brief Make the next package a snapshot, e.g. on a StatusRequestPackage
+   */
+  void requestFull() { fullRequested = true; }
+
+ protected:
+  StatusPackage last;
+  uint32_t version = 0;
+  uint16_t sinceFull = 0;
+  bool fullRequested = false;
+};
+
+/**
+ * @brief Result of StatusDeltaDecoder::apply()
+ */
+enum class StatusUpdate {
+  SNAPSHOT,       // Status replaced by a snapshot
+  APPLIED,        // Delta applied
+  IGNORED,        // Old or duplicate package, or still waiting for a snapshot
+  NEED_SNAPSHOT,  // A delta is missing, ask the node for a snapshot
+};
+
+/**
+ * @brief Keeps the complete status of every node from their deltas
+ */
+class StatusDeltaDecoder {
+ public:
+  StatusUpdate apply(const StatusDeltaPackage& pkg) {
+    auto& node = nodes[pkg.from];
+    if (pkg.snapshot()) {
+      // Any other snapshot is taken, the node may have restarted
+      if (node.known && pkg.version == node.version && !node.waiting)
+        return StatusUpdate::IGNORED;
+      node.status = StatusPackage();
+      merge(node, pkg);
+      return StatusUpdate::SNAPSHOT;
+    }
+    if (node.known && pkg.base == node.version) {
+      merge(node, pkg);
+      return StatusUpdate::APPLIED;
+    }
+    if (node.known && (int32_t)(pkg.version - node.version) <= 0)
+      return StatusUpdate::IGNORED;
+    if (node.waiting) return StatusUpdate::IGNORED;
+    node.waiting = true;
+    return StatusUpdate::NEED_SNAPSHOT;
+  }
+
+  /**
+   * @brief Status of a node, nullptr if we have no snapshot of it yet
+   */
+  const StatusPackage* get(uint32_t nodeId) const {
+    auto it = nodes.find(nodeId);
+    if (it == nodes.end() || !it->second.known) return nullptr;
+    return &it->second.status;
+  }
+
+  /**
+   * @brief Forget a node, e.g. when it left the mesh
+   */
+  void forget(uint32_t nodeId) { nodes.erase(nodeId); }
+
+  size_t size() const { return nodes.size(); }
+
+ protected:
+  struct Node {
+    StatusPackage status;
+    uint32_t version = 0;
+    bool known = false;
+    bool waiting = false;  // Asked for a snapshot
+  };
+
+  void merge(Node& node, const StatusDeltaPackage& pkg) {
+    delta::Copier copier;
+    copier.mask = pkg.fields;
+    delta::visitFields(node.status, pkg.status, copier);
+    node.status.from = pkg.from;
+    node.version = pkg.version;
+    node.known = true;
+    node.waiting = false;
+  }
+
+  std::map<uint32_t, Node> nodes;
+};
+
+}  // namespace alteriom
+
+#endif  // ALTERIOM_STATUS_DELTA_HPP
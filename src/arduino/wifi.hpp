@@ -21,6 +21,16 @@
 #include <WiFiClientSecure.h>
 #endif
 
+#ifndef BRIDGE_STATUS_CHECK_INTERVAL
+#define BRIDGE_STATUS_CHECK_INTERVAL 5 * TASK_SECOND  // Look for changes
+#endif
+#ifndef BRIDGE_STATUS_RSSI_CHANGE
+#define BRIDGE_STATUS_RSSI_CHANGE 6  // dB router RSSI change to announce
+#endif
+#ifndef BRIDGE_KEEPALIVE_MAX_INTERVAL
+#define BRIDGE_KEEPALIVE_MAX_INTERVAL 300000  // ms, longest keepalive interval
+#endif
+
 extern painlessmesh::logger::LogClass Log;
 
 namespace painlessmesh {
@@ -728,6 +738,31 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     return _sharedGatewayConfig;
   }
 
+  /**
+   * Periodically move to a better parent
+   *
+   * By default a node stays with its parent until the connection is lost.
+   * With rebalancing enabled the node moves to another node in the mesh when
+   * that one is a clearly better parent (closer to the root, or in a less
+   * loaded branch). See StationScan::rebalanceParent().
+   */
+  void enableRebalancing(bool enable = true) { stationScan.rebalance = enable; }
+
+  /**
+   * Number of times this node moved to a better parent
+   */
+  uint32_t getRebalanceCount() const { return stationScan.rebalances; }
+
+  /**
+   * How long it took to get a parent back after losing it
+   *
+   * Also counts how often a cached parent was used (see
+   * StationScan::fastReconnect()) and how often we had to scan instead.
+   */
+  ReconnectStats getReconnectStats() const {
+    return stationScan.reconnectStats;
+  }
+
   /**
    * Connect (as a station) to a specified network and ip
    *
@@ -764,6 +799,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     this->droppedConnectionCallbacks.push_back(
         [this](uint32_t nodeId, bool station) {
           if (station) {
+            stationScan.onParentLost();
             if (WiFi.status() == WL_CONNECTED) {
               WiFi.disconnect();
               // Schedule reconnection after disconnect completes
@@ -775,6 +811,8 @@ class Mesh : public painlessmesh::Mesh<Connection> {
             }
           }
         });
+    this->newConnectionCallbacks.push_back(
+        [this](uint32_t nodeId) { stationScan.onConnected(nodeId); });
   }
 
   /**
@@ -1043,7 +1081,8 @@ class Mesh : public painlessmesh::Mesh<Connection> {
                 auto it = this->lastBridgeCoordinationState.find(fromNode);
                 if (it == this->lastBridgeCoordinationState.end()) {
                   this->lastBridgeCoordinationState[fromNode] = {
-                      pkg.priority, pkg.role, pkg.load, (uint32_t)millis()};
+                      pkg.priority, pkg.role, pkg.load, (uint32_t)millis(),
+                      pkg.next};
                   this->bridgeCoordinationChangedCallback(pkg, fromNode,
                                                           "new");
                 } else {
@@ -1055,6 +1094,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
                   prev.role = pkg.role;
                   prev.load = pkg.load;
                   prev.lastSeen = (uint32_t)millis();
+                  prev.nextMs = pkg.next;
                   if (changed) {
                     this->bridgeCoordinationChangedCallback(pkg, fromNode,
                                                             "updated");
@@ -1074,7 +1114,8 @@ class Mesh : public painlessmesh::Mesh<Connection> {
    * Set callback for bridge coordination state changes
    *
    * Called when a new bridge is discovered, an existing bridge changes its
-   * priority/role/load, or a bridge is lost (no coordination message for 60s).
+   * priority/role/load, or a bridge is lost (no coordination message within
+   * the bridge time out, see setBridgeTimeout()).
    *
    * @param callback Function called with the coordination package, sender node
    * ID, and change type ("new", "updated", or "lost")
@@ -1087,13 +1128,16 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     bridgeCoordinationChangedCallback = callback;
 
     // Start periodic lost-detection task (every 30 seconds, check for
-    // bridges that haven't sent a coordination message in 60 seconds)
+    // bridges that haven't sent a coordination message within the bridge
+    // time out, or twice the time they announced for their next one)
     bridgeLostDetectionTask = this->addTask(
         30000, TASK_FOREVER, [this]() {
           uint32_t now = (uint32_t)millis();
           for (auto it = this->lastBridgeCoordinationState.begin();
                it != this->lastBridgeCoordinationState.end();) {
-            if ((now - it->second.lastSeen) > 60000) {
+            auto timeout =
+                (std::max)(this->bridgeTimeoutMs, 2 * it->second.nextMs);
+            if ((now - it->second.lastSeen) > timeout) {
               uint32_t lostNode = it->first;
               // Create a package with last known state for the callback
               plugin::BridgeCoordinationPackage pkg;
@@ -1162,6 +1206,18 @@ class Mesh : public painlessmesh::Mesh<Connection> {
         maxBridges);
   }
 
+  /**
+   * Advertise the uplink capacity of this bridge
+   *
+   * Nodes that stripe their Internet requests over several bridges (see
+   * enableUplinkStriping()) send each bridge a share of the requests
+   * proportional to its capacity. Bridges that don't advertise a capacity
+   * are weighted by their router signal instead (10 to 70).
+   *
+   * @param capacity Relative capacity (1-255), 0 to derive it from the signal
+   */
+  void setBridgeCapacity(uint8_t capacity) { bridgeCapacity = capacity; }
+
   /**
    * Get list of all active bridges (with Internet connection)
    *
@@ -1172,7 +1228,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     auto bridges = this->getBridges();
 
     for (const auto& bridge : bridges) {
-      if (bridge.internetConnected && bridge.isHealthy()) {
+      if (bridge.internetConnected && bridge.isHealthy(bridgeTimeoutMs)) {
         activeBridges.push_back(bridge.nodeId);
       }
     }
@@ -1264,7 +1320,8 @@ class Mesh : public painlessmesh::Mesh<Connection> {
         int8_t bestRSSI = -127;
 
         for (const auto& bridge : this->getBridges()) {
-          if (bridge.internetConnected && bridge.isHealthy() &&
+          if (bridge.internetConnected &&
+              bridge.isHealthy(bridgeTimeoutMs) &&
               bridge.routerRSSI > bestRSSI) {
             bestRSSI = bridge.routerRSSI;
             bestBridge = bridge.nodeId;
@@ -1400,7 +1457,8 @@ class Mesh : public painlessmesh::Mesh<Connection> {
                                WiFi.channel(),  // routerChannel
                                millis(),        // uptime
                                WiFi.gatewayIP().toString(),  // gatewayIP
-                               this->getNodeTime()           // timestamp
+                               this->getNodeTime(),          // timestamp
+                               bridgeCapacity                // capacity
       );
 
       Log(STARTUP,
@@ -1412,8 +1470,9 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     // Create periodic task to broadcast bridge status
     // Schedule with delay to avoid crashes during stop/init cycle
     this->addTask(INIT_DELAY_MS, TASK_ONCE, [this]() {
-      bridgeStatusTask = this->addTask(this->bridgeStatusIntervalMs, TASK_FOREVER,
-                                       [this]() { this->sendBridgeStatus(); });
+      bridgeStatusTask =
+          this->addTask(BRIDGE_STATUS_CHECK_INTERVAL, TASK_FOREVER,
+                        [this]() { this->announceBridgeStatus(); });
     });
 
     // Send immediate broadcast so nodes can discover this bridge right away
@@ -1449,37 +1508,24 @@ class Mesh : public painlessmesh::Mesh<Connection> {
               nodeId);
           return;
         }
+        // Nodes further away joined as well, they only know us once we send
+        // a full status again
+        this->bridgeTopologyChanged = true;
 
-        // Create bridge status message
-        JsonDocument doc;
-        JsonObject obj = doc.to<JsonObject>();
-
-        obj["type"] = protocol::BRIDGE_STATUS;
-        obj["from"] = this->nodeId;
-        obj["routing"] = 1;  // SINGLE routing (direct to node)
-        obj["dest"] = nodeId;
-        obj["timestamp"] = this->getNodeTime();
-
-        bool hasInternet = (WiFi.status() == WL_CONNECTED) &&
-                           (WiFi.localIP() != IPAddress(0, 0, 0, 0));
-        obj["internetConnected"] = hasInternet;
-        obj["routerRSSI"] = WiFi.RSSI();
-        obj["routerChannel"] = WiFi.channel();
-        obj["uptime"] = millis();
-        obj["gatewayIP"] = WiFi.gatewayIP().toString();
-        obj["message_type"] = protocol::BRIDGE_STATUS;
-
-        String msg;
-        serializeJson(doc, msg);
+        // Create bridge status message, routed directly to the node
+        auto pkg = this->bridgeStatus();
+        pkg.routing = router::SINGLE;
+        pkg.dest = nodeId;
 
         Log(CONNECTION,
             "Sending bridge status directly to node %u (Internet: %s)\n",
-            nodeId, hasInternet ? "YES" : "NO");
+            nodeId, pkg.internetConnected ? "YES" : "NO");
 
         // Send directly to the connection with high priority
         // This ensures the message is sent immediately rather than queued
-        // The JSON message format is the same as what router::send() produces
-        // (Variant serializes to the same JSON format we built manually)
+        protocol::Variant variant(&pkg);
+        TSTRING msg;
+        variant.printTo(msg);
         conn->addMessage(msg, true);
       });
     });
@@ -1527,6 +1573,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
             uint8_t priority = obj["priority"];
             TSTRING role = obj["role"].as<TSTRING>();
             uint8_t load = obj["load"] | 0;
+            uint32_t nextMs = obj["next"] | 0;
 
             // Store bridge priority for selection decisions
             bridgePriorities[fromNode] = priority;
@@ -1564,7 +1611,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
               auto it = this->lastBridgeCoordinationState.find(fromNode);
               if (it == this->lastBridgeCoordinationState.end()) {
                 this->lastBridgeCoordinationState[fromNode] = {
-                    priority, role, load, (uint32_t)millis()};
+                    priority, role, load, (uint32_t)millis(), nextMs};
                 this->bridgeCoordinationChangedCallback(pkg, fromNode, "new");
               } else {
                 auto& prev = it->second;
@@ -1575,6 +1622,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
                 prev.role = role;
                 prev.load = load;
                 prev.lastSeen = (uint32_t)millis();
+                prev.nextMs = nextMs;
                 if (changed) {
                   this->bridgeCoordinationChangedCallback(pkg, fromNode,
                                                           "updated");
@@ -1585,10 +1633,11 @@ class Mesh : public painlessmesh::Mesh<Connection> {
           return false;  // Don't consume the package
         });
 
-    // Create periodic task to send coordination messages
+    // Create periodic task to send coordination messages when something
+    // changed, or as keepalive with a growing interval
     bridgeCoordinationTask = this->addTask(
-        30000,  // 30 seconds interval
-        TASK_FOREVER, [this]() { this->sendBridgeCoordination(); });
+        BRIDGE_STATUS_CHECK_INTERVAL, TASK_FOREVER,
+        [this]() { this->sendBridgeCoordination(); });
 
     Log(STARTUP, "Bridge coordination enabled (priority: %d, role: %s)\n",
         bridgePriority, bridgeRole.c_str());
@@ -1597,6 +1646,12 @@ class Mesh : public painlessmesh::Mesh<Connection> {
   /**
    * Send bridge coordination message to other bridges
    * Called periodically in multi-bridge mode
+   *
+   * Changes in priority, role, load or peers are send right away, otherwise
+   * the message is repeated with an interval growing from 30 seconds up to
+   * BRIDGE_KEEPALIVE_MAX_INTERVAL (half the bridge time out with
+   * setBridgeStatusCompat()). Every message tells the receivers when the next
+   * one is due at the latest.
    */
   void sendBridgeCoordination() {
     using namespace logger;
@@ -1613,6 +1668,21 @@ class Mesh : public painlessmesh::Mesh<Connection> {
       if (currentLoad > 100) currentLoad = 100;
     }
 
+    bool changed = bridgePriority != lastCoordination.priority ||
+                   bridgeRole != lastCoordination.role ||
+                   currentLoad != lastCoordination.load ||
+                   knownBridgePeers != lastCoordination.peerBridges;
+    uint32_t maxInterval = this->bridgeStatusCompat
+                               ? this->bridgeTimeoutMs / 2
+                               : BRIDGE_KEEPALIVE_MAX_INTERVAL;
+    maxInterval = (std::max)((uint32_t)30000, maxInterval);
+    if (!coordinationBackoff.due(changed, millis(), 30000, maxInterval))
+      return;
+    lastCoordination.priority = bridgePriority;
+    lastCoordination.role = bridgeRole;
+    lastCoordination.load = currentLoad;
+    lastCoordination.peerBridges = knownBridgePeers;
+
     // Create coordination message
     JsonDocument doc;
     JsonObject obj = doc.to<JsonObject>();
@@ -1625,6 +1695,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     obj["load"] = currentLoad;
     obj["timestamp"] = this->getNodeTime();
     obj["message_type"] = 613;
+    obj["next"] = coordinationBackoff.current();
 
     // Add peer bridges list
     JsonArray peers = obj["peerBridges"].to<JsonArray>();
@@ -2163,43 +2234,10 @@ class Mesh : public painlessmesh::Mesh<Connection> {
       return;
     }
 
-    // Create bridge status package
-    // We need to include the package header here since we're in wifi namespace
-    // The package will be sent as a JSON string
-    JsonDocument doc;
-    JsonObject obj = doc.to<JsonObject>();
-
-    obj["type"] = protocol::BRIDGE_STATUS;
-    obj["from"] = this->nodeId;
-    obj["routing"] = 2;  // BROADCAST routing
-    obj["timestamp"] = this->getNodeTime();
-
-    // Check Internet connectivity: WiFi connected AND valid IP address
-    // We check for valid local IP instead of gateway IP because:
-    // 1. Gateway IP might not be immediately available after connection
-    // 2. Some networks (mobile hotspots) may not provide gateway IP via DHCP
-    // 3. Having a valid local IP + being connected is sufficient for internet
-    // access
-    bool hasInternet = (WiFi.status() == WL_CONNECTED) &&
-                       (WiFi.localIP() != IPAddress(0, 0, 0, 0));
-    obj["internetConnected"] = hasInternet;
-
-    int8_t rssi = WiFi.RSSI();
-    uint8_t channel = WiFi.channel();
-    uint32_t uptime = millis();
-    TSTRING gatewayIP = WiFi.gatewayIP().toString();
-
-    obj["routerRSSI"] = rssi;
-    obj["routerChannel"] = channel;
-    obj["uptime"] = uptime;
-    obj["gatewayIP"] = gatewayIP;
-    obj["message_type"] = protocol::BRIDGE_STATUS;
-
-    String msg;
-    serializeJson(doc, msg);
+    auto pkg = this->bridgeStatus();
 
     Log(GENERAL, "sendBridgeStatus(): Broadcasting status (Internet: %s)\n",
-        hasInternet ? "Connected" : "Disconnected");
+        pkg.internetConnected ? "Connected" : "Disconnected");
     Log(GENERAL,
         "sendBridgeStatus(): WiFi status=%d, localIP=%s, gatewayIP=%s\n",
         WiFi.status(), WiFi.localIP().toString().c_str(),
@@ -2207,14 +2245,94 @@ class Mesh : public painlessmesh::Mesh<Connection> {
 
     // Update our own bridge status in knownBridges list
     // This ensures the bridge reports itself correctly when queried
-    this->updateBridgeStatus(this->nodeId, hasInternet, rssi, channel, uptime,
-                             gatewayIP, this->getNodeTime());
+    this->updateBridgeStatus(this->nodeId, pkg.internetConnected,
+                             pkg.routerRSSI, pkg.routerChannel, pkg.uptime,
+                             pkg.gatewayIP, pkg.timestamp, pkg.capacity);
+
+    // Serialized once, straight from the package
+    this->sendPackage(&pkg);
+    lastBridgeStatus = pkg;
+    bridgeTopologyChanged = false;
+    bridgeStatusBackoff.reset(millis(), this->bridgeStatusIntervalMs);
+  }
 
-    // Send bridge status using raw broadcast to preserve type BRIDGE_STATUS
-    // Using sendBroadcast(msg) would wrap it in type 8 (BROADCAST) and hide
-    // type BRIDGE_STATUS
-    protocol::Variant variant(msg);
-    router::broadcast<protocol::Variant, Connection>(variant, (*this), 0);
+  /**
+   * Broadcast the bridge status if it changed, or a compact keepalive
+   *
+   * Full status is send when the Internet connection, router channel or
+   * gateway changed, the router RSSI moved by BRIDGE_STATUS_RSSI_CHANGE or
+   * more, or new nodes joined the mesh. Otherwise keepalives are send with an
+   * interval that doubles from bridgeStatusIntervalMs up to
+   * BRIDGE_KEEPALIVE_MAX_INTERVAL. Each keepalive carries the interval to the
+   * next one, so receivers don't consider a quiet bridge lost meanwhile.
+   *
+   * With setBridgeStatusCompat() the full status is send every
+   * bridgeStatusIntervalMs instead, for nodes that don't know keepalives.
+   */
+  void announceBridgeStatus() {
+    using namespace logger;
+    if (!this->bridgeStatusBroadcastEnabled) return;
+
+    auto pkg = this->bridgeStatus();
+    int rssiChange = (int)pkg.routerRSSI - (int)lastBridgeStatus.routerRSSI;
+    bool changed = bridgeTopologyChanged ||
+                   pkg.internetConnected != lastBridgeStatus.internetConnected ||
+                   pkg.routerChannel != lastBridgeStatus.routerChannel ||
+                   pkg.gatewayIP != lastBridgeStatus.gatewayIP ||
+                   pkg.capacity != lastBridgeStatus.capacity ||
+                   rssiChange >= BRIDGE_STATUS_RSSI_CHANGE ||
+                   rssiChange <= -BRIDGE_STATUS_RSSI_CHANGE;
+    if (changed) {
+      this->sendBridgeStatus();
+      return;
+    }
+
+    uint32_t maxInterval = this->bridgeStatusCompat
+                               ? this->bridgeStatusIntervalMs
+                               : BRIDGE_KEEPALIVE_MAX_INTERVAL;
+    maxInterval = (std::max)(this->bridgeStatusIntervalMs, maxInterval);
+    if (!bridgeStatusBackoff.due(false, millis(), this->bridgeStatusIntervalMs,
+                                 maxInterval))
+      return;
+
+    if (this->bridgeStatusCompat) {
+      this->sendBridgeStatus();
+      return;
+    }
+
+    // Keep our own entry fresh, then tell the others we are still here
+    auto nextMs = bridgeStatusBackoff.current();
+    this->refreshBridge(this->nodeId, nextMs);
+    plugin::BridgeStatusPackage keepalive;
+    keepalive.from = this->nodeId;
+    keepalive.unchanged = true;
+    keepalive.next = nextMs;
+    Log(GENERAL, "announceBridgeStatus(): Keepalive, next in %u ms\n",
+        nextMs);
+    this->sendPackage(&keepalive);
+  }
+
+  /**
+   * Current status of this bridge
+   */
+  plugin::BridgeStatusPackage bridgeStatus() {
+    plugin::BridgeStatusPackage pkg;
+    pkg.from = this->nodeId;
+    pkg.timestamp = this->getNodeTime();
+    // Check Internet connectivity: WiFi connected AND valid IP address
+    // We check for valid local IP instead of gateway IP because:
+    // 1. Gateway IP might not be immediately available after connection
+    // 2. Some networks (mobile hotspots) may not provide gateway IP via DHCP
+    // 3. Having a valid local IP + being connected is sufficient for internet
+    // access
+    pkg.internetConnected = (WiFi.status() == WL_CONNECTED) &&
+                            (WiFi.localIP() != IPAddress(0, 0, 0, 0));
+    pkg.routerRSSI = WiFi.RSSI();
+    pkg.routerChannel = WiFi.channel();
+    pkg.uptime = millis();
+    pkg.gatewayIP = WiFi.gatewayIP().toString();
+    pkg.capacity = bridgeCapacity;
+    return pkg;
   }
 
   /**
@@ -2494,6 +2612,13 @@ class Mesh : public painlessmesh::Mesh<Connection> {
 #endif
           }
 
+          // Striped requests can arrive out of order, let the destination
+          // restore it
+          if (pkg.sequence != 0) {
+            http.addHeader("X-Mesh-Origin", String(pkg.originNode));
+            http.addHeader("X-Mesh-Sequence", String(pkg.sequence));
+          }
+
           // Make request (GET if no payload, POST if payload)
           if (pkg.payload.length() > 0) {
             http.addHeader("Content-Type", pkg.contentType.c_str());
@@ -2674,6 +2799,13 @@ class Mesh : public painlessmesh::Mesh<Connection> {
   AsyncServer* _tcpListener;
   std::shared_ptr<Task> bridgeStatusTask;
 
+  // Adaptive bridge status, see announceBridgeStatus()
+  plugin::BridgeStatusPackage lastBridgeStatus;
+  plugin::AnnounceBackoff bridgeStatusBackoff;
+  bool bridgeTopologyChanged = false;
+  plugin::BridgeCoordinationPackage lastCoordination;
+  plugin::AnnounceBackoff coordinationBackoff;
+
   // Station disconnect handling state
   bool _pendingStationReconnect = false;
 
@@ -2729,6 +2861,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
   BridgeSelectionStrategy bridgeSelectionStrategy = PRIORITY_BASED;
   uint8_t maxConcurrentBridges = 2;
   uint8_t bridgePriority = 5;        // Default medium priority
+  uint8_t bridgeCapacity = 0;        // Advertised uplink capacity, 0 = signal
   TSTRING bridgeRole = "secondary";  // Default role
   std::shared_ptr<Task> bridgeCoordinationTask;
   std::map<uint32_t, uint8_t> bridgePriorities;  // nodeId -> priority mapping
@@ -2741,6 +2874,7 @@ class Mesh : public painlessmesh::Mesh<Connection> {
     TSTRING role;
     uint8_t load;
     uint32_t lastSeen;
+    uint32_t nextMs;  // Announced time until the next message, 0 if unknown
   };
   std::map<uint32_t, BridgeCoordinationState> lastBridgeCoordinationState;
   std::function<void(const plugin::BridgeCoordinationPackage&, uint32_t)> bridgeCoordinationCallback;
@@ -118,6 +118,7 @@ void ICACHE_FLASH_ATTR StationScan::scanComplete() {
 
     record.rssi = WiFi.RSSI(i);
     if (record.rssi == 0) continue;
+    record.channel = WiFi.channel(i);
 
     memcpy((void *)&record.bssid, (void *)WiFi.BSSID(i), sizeof(record.bssid));
     aps.push_back(record);
@@ -128,15 +129,19 @@ void ICACHE_FLASH_ATTR StationScan::scanComplete() {
   Log(CONNECTION, "\tFound %d nodes\n", aps.size());
 
   task.yield([this]() {
+    // Known nodes are filtered below, so look for a better parent first
+    if (rebalance && rebalanceParent()) return;
+
     // Task filter all unknown
     filterAPs();
 
     lastAPs = aps;
 
-    // Next task is to sort by strength
+    // Next task is to sort by suitability as parent
     task.yield([this] {
-      aps.sort([](WiFi_AP_Record_t a, WiFi_AP_Record_t b) {
-        return a.rssi > b.rssi;
+      updatePositions();
+      aps.sort([this](const WiFi_AP_Record_t &a, const WiFi_AP_Record_t &b) {
+        return parentScore(a) > parentScore(b);
       });
       // Next task is to connect to the top ap
       task.yield([this]() { connectToAP(); });
@@ -144,6 +149,193 @@ void ICACHE_FLASH_ATTR StationScan::scanComplete() {
   });
 }
 
+void ICACHE_FLASH_ATTR StationScan::updatePositions() {
+  // Without connections we only know ourselves, keep the old layout. Without
+  // a parent we only know our own subtree, keep the layout from before
+  if (mesh->subs.empty() || positionsFrozen) return;
+  auto tree = mesh->asNodeTree();
+  positions = painlessmesh::layout::positions(tree);
+  positionNodes = positions.size();
+  positionsRooted = painlessmesh::layout::isRooted(tree);
+}
+
+int16_t ICACHE_FLASH_ATTR
+StationScan::parentScore(const WiFi_AP_Record_t &ap) const {
+  int16_t score = ap.rssi;
+  auto it = positions.find(painlessmesh::tcp::encodeNodeId(ap.bssid));
+  if (it == positions.end()) return score;
+  auto &pos = it->second;
+  // Depth is only meaningful if measured from the root
+  if (positionsRooted) score -= STATION_DEPTH_PENALTY * pos.depth;
+  // A full node will refuse us anyway
+  uint16_t children = pos.connections - (pos.depth > 0 ? 1 : 0);
+  if (children >= MAX_CONN) score -= 100;
+  score -= STATION_LOAD_PENALTY * pos.connections;
+  if (positionNodes > 0)
+    score -= STATION_BRANCH_PENALTY * pos.branch / positionNodes;
+  return score;
+}
+
+bool ICACHE_FLASH_ATTR StationScan::rebalanceParent() {
+  using namespace painlessmesh;
+  using namespace painlessmesh::logger;
+  if (manual || WiFi.status() != WL_CONNECTED) return false;
+  if (millis() - lastParentChange < REBALANCE_INTERVAL) return false;
+
+  std::shared_ptr<Connection> parent;
+  for (auto &&conn : mesh->subs) {
+    if (conn->station && conn->connected()) parent = conn;
+  }
+  if (!parent) return false;
+
+  updatePositions();
+  auto self = positions.find(mesh->getNodeId());
+  auto current = aps.end();
+  auto best = aps.end();
+  int16_t bestScore = 0;
+  for (auto ap = aps.begin(); ap != aps.end(); ++ap) {
+    auto apNodeId = tcp::encodeNodeId(ap->bssid);
+    if (apNodeId == parent->nodeId) {
+      current = ap;
+      continue;
+    }
+    // Nodes that are not reached through our parent are behind us, connecting
+    // to them would create a loop. Unknown nodes are handled by connectToAP()
+    if (router::findRoute<Connection>((*mesh), apNodeId) != parent) continue;
+    if (isNodeBlocked(apNodeId)) continue;
+
+    auto score = parentScore(*ap);
+    auto pos = positions.find(apNodeId);
+    if (self != positions.end() && pos != positions.end() &&
+        pos->second.branchId == self->second.branchId && positionNodes > 0) {
+      // Our own subtree already counts towards this branch
+      score += STATION_BRANCH_PENALTY * self->second.subtree / positionNodes;
+    }
+    if (best == aps.end() || score > bestScore) {
+      best = ap;
+      bestScore = score;
+    }
+  }
+  if (current == aps.end() || best == aps.end()) return false;
+
+  // The current parent carries our own connection and subtree, which would
+  // move with us
+  auto currentScore = parentScore(*current) + STATION_LOAD_PENALTY;
+  if (self != positions.end() && positionNodes > 0)
+    currentScore += STATION_BRANCH_PENALTY * self->second.subtree / positionNodes;
+  if (bestScore < currentScore + REBALANCE_HYSTERESIS) return false;
+
+  // Don't throw away messages still waiting for the old parent, try again
+  // after the next scan
+  if (parent->queueSize() > 0) {
+    Log(CONNECTION, "rebalanceParent(): Postponed, messages still queued\n");
+    return false;
+  }
+
+  Log(CONNECTION, "rebalanceParent(): Moving from %u (score %d) to %u (%d)\n",
+      parent->nodeId, currentScore, tcp::encodeNodeId(best->bssid), bestScore);
+  ++rebalances;
+  lastParentChange = millis();
+  // Connect to the new parent straight away when the station disconnect
+  // triggers connectToAP(), instead of scanning again first
+  WiFi_AP_Record_t target = *best;
+  aps.clear();
+  aps.push_back(target);
+  lastAPs = aps;
+  // We are leaving the parent on purpose, so don't let onParentLost() send us
+  // back to it with a fast reconnect
+  hasLastParent = false;
+  task.setCallback([this]() { stationScan(); });
+  task.delay(4 * SCAN_INTERVAL);
+  mesh->closeConnectionSTA();
+  Log.remote("Close Sta to move to a better parent\n");
+  return true;
+}
+
+void ICACHE_FLASH_ATTR StationScan::onParentLost() {
+  // Only count losing a parent we actually had, not failed attempts
+  if (reconnecting || !hasLastParent) return;
+  reconnecting = true;
+  fastAttempted = false;
+  disconnectedAt = millis();
+  // The positions of the last scan still describe the whole mesh, unlike the
+  // subtree we are left with
+  positionsFrozen = true;
+
+  // Last good parent first, then the best candidates of the last scan
+  cachedAPs.clear();
+  if (hasLastParent) cachedAPs.push_back(lastParent);
+  auto candidates = lastAPs;
+  candidates.sort([this](const WiFi_AP_Record_t &a, const WiFi_AP_Record_t &b) {
+    return parentScore(a) > parentScore(b);
+  });
+  for (auto &&ap : candidates) {
+    if (cachedAPs.size() >= FAST_RECONNECT_ATTEMPTS) break;
+    if (hasLastParent &&
+        memcmp(ap.bssid, lastParent.bssid, sizeof(ap.bssid)) == 0)
+      continue;
+    cachedAPs.push_back(ap);
+  }
+}
+
+bool ICACHE_FLASH_ATTR StationScan::fastReconnect() {
+  using namespace painlessmesh;
+  using namespace painlessmesh::logger;
+  if (!reconnecting) return false;
+  while (!cachedAPs.empty()) {
+    auto ap = cachedAPs.front();
+    cachedAPs.pop_front();
+    auto apNodeId = tcp::encodeNodeId(ap.bssid);
+    // Nodes that are still reachable are behind us now
+    if (ap.channel != mesh->_meshChannel ||
+        router::findRoute<Connection>((*mesh), apNodeId) != NULL ||
+        isNodeBlocked(apNodeId))
+      continue;
+    Log(CONNECTION, "fastReconnect(): Trying cached parent %u\n", apNodeId);
+    fastAttempted = true;
+    requestIP(ap);
+    // Try the next cached parent if this one doesn't work out
+    task.setCallback([this]() { connectToAP(); });
+    task.delay(FAST_RECONNECT_TIMEOUT);
+    return true;
+  }
+  if (!fastAttempted) return false;
+  Log(CONNECTION, "fastReconnect(): Cached parents failed, scanning\n");
+  ++reconnectStats.scanFallbacks;
+  fastAttempted = false;
+  task.forceNextIteration();
+  return true;
+}
+
+void ICACHE_FLASH_ATTR StationScan::onConnected(uint32_t nodeId) {
+  using namespace painlessmesh::logger;
+  bool station = false;
+  for (auto &&conn : mesh->subs) {
+    if (conn->nodeId == nodeId && conn->station) station = true;
+  }
+  if (!station) return;
+
+  if (painlessmesh::tcp::encodeNodeId(connecting.bssid) == nodeId) {
+    lastParent = connecting;
+    hasLastParent = true;
+  }
+  positionsFrozen = false;
+  if (!reconnecting) return;
+  reconnecting = false;
+  cachedAPs.clear();
+  auto duration = millis() - disconnectedAt;
+  ++reconnectStats.reconnects;
+  if (fastAttempted) ++reconnectStats.fastReconnects;
+  reconnectStats.lastReconnectMs = duration;
+  if (reconnectStats.averageReconnectMs == 0)
+    reconnectStats.averageReconnectMs = duration;
+  else
+    reconnectStats.averageReconnectMs =
+        (3 * reconnectStats.averageReconnectMs + duration) / 4;
+  Log(CONNECTION, "onConnected(): Reconnected to %u after %u ms\n", nodeId,
+      duration);
+}
+
 void ICACHE_FLASH_ATTR StationScan::blockNodeAfterTCPFailure(uint32_t nodeId, uint32_t blockDurationMs) {
   using namespace painlessmesh::logger;
   uint32_t blockUntil = millis() + blockDurationMs;
@@ -215,13 +407,15 @@ void ICACHE_FLASH_ATTR StationScan::filterAPs() {
 
 void ICACHE_FLASH_ATTR StationScan::requestIP(WiFi_AP_Record_t &ap) {
   using namespace painlessmesh::logger;
-  Log(CONNECTION, "connectToAP(): Best AP is %u<---\n",
-      painlessmesh::tcp::encodeNodeId(ap.bssid));
+  Log(CONNECTION, "connectToAP(): Best AP is %u (score %d)<---\n",
+      painlessmesh::tcp::encodeNodeId(ap.bssid), parentScore(ap));
   Log(CONNECTION, "requestIP(): Connecting to %s (channel: %d, BSSID: %02X:%02X:%02X:%02X:%02X:%02X)\n", 
       ap.ssid.c_str(), 
       mesh->_meshChannel,
       ap.bssid[0], ap.bssid[1], ap.bssid[2], 
       ap.bssid[3], ap.bssid[4], ap.bssid[5]);
+  lastParentChange = millis();
+  connecting = ap;
   WiFi.begin(ap.ssid.c_str(), password.c_str(), mesh->_meshChannel, ap.bssid);
   return;
 }
@@ -258,6 +452,9 @@ void ICACHE_FLASH_ATTR StationScan::connectToAP() {
     }
   }
   bool isRooted = layout::isRooted(mesh->asNodeTree());
+  // After losing the parent the cached parents go first, aps can still hold
+  // leftovers of an older scan
+  if (WiFi.status() != WL_CONNECTED && fastReconnect()) return;
   if (aps.empty()) {
     // No unknown nodes found
     consecutiveEmptyScans++;
@@ -3,17 +3,57 @@
 
 #include "painlessmesh/configuration.hpp"
 
+#include "painlessmesh/layout.hpp"
 #include "painlessmesh/mesh.hpp"
 
 #include <list>
 #include <map>
 
+// Penalties used when choosing a parent, in dB of signal strength
+#ifndef STATION_DEPTH_PENALTY
+#define STATION_DEPTH_PENALTY 6  // Per hop between the candidate and the root
+#endif
+#ifndef STATION_LOAD_PENALTY
+#define STATION_LOAD_PENALTY 3  // Per connection the candidate already has
+#endif
+#ifndef STATION_BRANCH_PENALTY
+#define STATION_BRANCH_PENALTY 10  // If the branch holds the whole mesh
+#endif
+
+// Rebalancing, see StationScan::rebalanceParent()
+#ifndef REBALANCE_HYSTERESIS
+#define REBALANCE_HYSTERESIS 8  // dB a new parent has to be better
+#endif
+#ifndef REBALANCE_INTERVAL
+#define REBALANCE_INTERVAL 5 * TASK_MINUTE  // Minimum time on one parent
+#endif
+
+// Fast reconnect, see StationScan::fastReconnect()
+#ifndef FAST_RECONNECT_ATTEMPTS
+#define FAST_RECONNECT_ATTEMPTS 2  // Cached parents tried before scanning
+#endif
+#ifndef FAST_RECONNECT_TIMEOUT
+#define FAST_RECONNECT_TIMEOUT 5 * TASK_SECOND  // Wait per cached parent
+#endif
+
 typedef struct {
   uint8_t bssid[6];
   TSTRING ssid;
   int8_t rssi;
+  uint8_t channel;
 } WiFi_AP_Record_t;
 
+/**
+ * Time needed to get a parent back after losing it
+ */
+struct ReconnectStats {
+  uint32_t reconnects = 0;          // Parent connections re-established
+  uint32_t fastReconnects = 0;      // ... to a cached parent, without a scan
+  uint32_t scanFallbacks = 0;       // Cached parents failed, scanned instead
+  uint32_t lastReconnectMs = 0;     // Time without parent, last time
+  uint32_t averageReconnectMs = 0;  // Smoothed time without parent
+};
+
 // Entry for tracking nodes where TCP connection failed
 typedef struct {
   uint32_t nodeId;
@@ -67,6 +107,70 @@ class StationScan {
   /// Valid APs found during the last scan
   std::list<WiFi_AP_Record_t> lastAPs;
 
+  /**
+   * How suitable an AP is as parent, higher is better
+   *
+   * Starts from the signal strength and subtracts penalties for the hops
+   * between the candidate and the root, the connections it already has and
+   * the share of the mesh that is already behind the same root connection.
+   * This keeps the tree shallow and spreads nodes over the branches, instead
+   * of everyone piling onto the strongest (often the same) node. Nodes whose
+   * position is not known are ranked on signal strength only.
+   */
+  int16_t parentScore(const WiFi_AP_Record_t &ap) const;
+
+  /**
+   * Remember where the nodes in the mesh are
+   *
+   * Uses the layout from the last node sync, so the information is still
+   * available after we lost our own connection and have to pick a new parent.
+   * After losing the parent the positions are kept as they were until we
+   * have a parent again, the subtree left behind us doesn't know the rest of
+   * the mesh. A node that joins for the first time knows no positions, and
+   * ranks its candidates on signal strength only.
+   */
+  void updatePositions();
+
+  /**
+   * Move to a better parent within the same mesh
+   *
+   * Only considered when rebalancing is enabled. A node normally stays with
+   * its parent until the link dies, even if the mesh grew around it. This
+   * compares the current parent with the other nodes found during the scan
+   * and switches when one of them scores at least REBALANCE_HYSTERESIS
+   * better. Nodes stay at least REBALANCE_INTERVAL with a parent, and the
+   * switch is postponed while messages are still queued for the old parent.
+   *
+   * \return true if we are switching to a new parent
+   */
+  bool rebalanceParent();
+
+  /**
+   * Connect to a cached parent without scanning first
+   *
+   * After losing the parent, the last good parent and the best APs of the
+   * last scan (BSSID and channel) are tried directly, waiting at most
+   * FAST_RECONNECT_TIMEOUT for each. Only if all of them fail do we fall back
+   * to a normal scan. This shortens the time the subtree is cut off.
+   *
+   * \return true if a connection attempt or scan was started
+   */
+  bool fastReconnect();
+
+  /// Called when the station connection to the parent is lost
+  void onParentLost();
+
+  /// Called when a new connection has been established
+  void onConnected(uint32_t nodeId);
+
+  ReconnectStats reconnectStats;
+
+  /// Periodically look for a better parent (see rebalanceParent())
+  bool rebalance = false;
+
+  /// Number of times this node moved to a better parent
+  uint32_t rebalances = 0;
+
  protected:
   TSTRING ssid;
   TSTRING password;
@@ -76,6 +180,26 @@ class StationScan {
   bool hidden;
   std::list<WiFi_AP_Record_t> aps;
 
+  // Position of the nodes in the mesh, as known during the last scan
+  std::map<uint32_t, painlessmesh::layout::NodePosition> positions;
+  uint32_t positionNodes = 0;
+  bool positionsRooted = false;
+  bool positionsFrozen = false;  // Parent lost, keep the positions from before
+
+  // When we last connected to a (new) parent
+  uint32_t lastParentChange = 0;
+
+  // AP we are connecting to and the last one that worked
+  WiFi_AP_Record_t connecting = WiFi_AP_Record_t();
+  WiFi_AP_Record_t lastParent = WiFi_AP_Record_t();
+  bool hasLastParent = false;
+
+  // Fast reconnect state
+  std::list<WiFi_AP_Record_t> cachedAPs;
+  bool reconnecting = false;
+  bool fastAttempted = false;
+  uint32_t disconnectedAt = 0;
+
   void requestIP(WiFi_AP_Record_t &ap);
 
   // Manually configure network and ip
@@ -0,0 +1,292 @@
+#ifndef _PAINLESS_MESH_AGGREGATE_HPP_
+#define _PAINLESS_MESH_AGGREGATE_HPP_
+
+/**
+ * @file aggregate.hpp
+ * @brief In-network aggregation of sensor readings
+ *
+ * When the consumer of sensor readings (the sink) only needs summaries, like
+ * a mean per zone, there is no need to carry every reading of every node all
+ * the way to it. Instead readings are reduced on the way:
+ *
+ * - Every node registers the same reducers (min, max, mean, count, last) for
+ *   a key, e.g. a sensor type or zone, with a window.
+ * - Nodes add their own readings with Mesh::contribute().
+ * - Relays that have reducers for all keys of an aggregate package on its way
+ *   to the sink merge it into their own partial aggregate instead of
+ *   forwarding it (see router::absorbAggregate()).
+ * - At the end of each window a node sends a single merged aggregate per key
+ *   towards the sink. The sink hands its aggregates to the application.
+ *
+ * The partial aggregates can be merged in any order, so relays without
+ * aggregation (or older nodes) simply forward the packages to the sink,
+ * which merges them itself. Traffic into the sink drops with the fan-in of
+ * the aggregating relays.
+ */
+
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/protocol.hpp"
+
+#ifndef AGGREGATE_MAX_KEYS
+#define AGGREGATE_MAX_KEYS 16  // Keys in a single aggregate package
+#endif
+#ifndef AGGREGATE_CHECK_INTERVAL
+#define AGGREGATE_CHECK_INTERVAL 250  // ms between checks for ended windows
+#endif
+
+namespace painlessmesh {
+namespace aggregate {
+
+/**
+ * Reducers, can be combined
+ */
+enum Reducer {
+  MIN = 1,
+  MAX = 2,
+  MEAN = 4,
+  COUNT = 8,
+  LAST = 16,
+  ALL = MIN | MAX | MEAN | COUNT | LAST
+};
+
+/**
+ * Readings of one key, reduced
+ *
+ * Only the fields of the selected reducers are kept and send. The count is
+ * always kept.
+ */
+struct Partial {
+  uint32_t key = 0;
+  uint8_t reducers = ALL;
+  uint32_t count = 0;
+  double sum = 0;
+  double min = 0;
+  double max = 0;
+  double last = 0;
+  uint32_t lastAt = 0;  // Mesh time of the last reading
+
+  void add(double value, uint32_t at) {
+    if (count == 0 || value < min) min = value;
+    if (count == 0 || value > max) max = value;
+    if (count == 0 || (int32_t)(at - lastAt) >= 0) {
+      last = value;
+      lastAt = at;
+    }
+    sum += value;
+    ++count;
+  }
+
+  /**
+   * Merge with readings reduced elsewhere
+   *
+   * Reducers that other doesn't have are dropped.
+   */
+  void merge(const Partial& other) {
+    if (other.count == 0) return;
+    reducers &= other.reducers;
+    if (count == 0 || other.min < min) min = other.min;
+    if (count == 0 || other.max > max) max = other.max;
+    if (count == 0 || (int32_t)(other.lastAt - lastAt) >= 0) {
+      last = other.last;
+      lastAt = other.lastAt;
+    }
+    sum += other.sum;
+    count += other.count;
+  }
+
+  double mean() const { return count > 0 ? sum / count : 0; }
+};
+
+/**
+ * Partial aggregates on their way to the sink
+ *
+ * Type ID: 670 (AGGREGATE)
+ * Routing: SINGLE, to the sink
+ */
+class AggregatePackage : public protocol::PackageInterface {
+ public:
+  int type = protocol::AGGREGATE;
+  uint32_t from = 0;
+  uint32_t dest = 0;  // The sink
+  std::vector<Partial> partials;
+
+  AggregatePackage() {}
+
+  AggregatePackage(JsonObject jsonObj) {
+    from = jsonObj["from"].as<uint32_t>();
+    dest = jsonObj["dest"].as<uint32_t>();
+    JsonArray items = jsonObj["aggr"];
+    for (JsonObject item : items) {
+      Partial partial;
+      partial.key = item["k"].as<uint32_t>();
+      partial.reducers = item["r"] | (int)ALL;
+      partial.count = item["n"].as<uint32_t>();
+      partial.sum = item["s"] | 0.0;
+      partial.min = item["lo"] | 0.0;
+      partial.max = item["hi"] | 0.0;
+      partial.last = item["v"] | 0.0;
+      partial.lastAt = item["t"] | 0u;
+      partials.push_back(partial);
+    }
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj["type"] = type;
+    jsonObj["routing"] = static_cast<int>(router::SINGLE);
+    jsonObj["from"] = from;
+    jsonObj["dest"] = dest;
+#if ARDUINOJSON_VERSION_MAJOR == 7
+    JsonArray items = jsonObj["aggr"].to<JsonArray>();
+#else
+    JsonArray items = jsonObj.createNestedArray("aggr");
+#endif
+    for (auto&& partial : partials) {
+#if ARDUINOJSON_VERSION_MAJOR == 7
+      JsonObject item = items.add<JsonObject>();
+#else
+      JsonObject item = items.createNestedObject();
+#endif
+      item["k"] = partial.key;
+      item["r"] = partial.reducers;
+      item["n"] = partial.count;
+      if (partial.reducers & MEAN) item["s"] = partial.sum;
+      if (partial.reducers & MIN) item["lo"] = partial.min;
+      if (partial.reducers & MAX) item["hi"] = partial.max;
+      if (partial.reducers & LAST) {
+        item["v"] = partial.last;
+        item["t"] = partial.lastAt;
+      }
+    }
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(partials.size()) +
+           partials.size() * JSON_OBJECT_SIZE(8);
+  }
+#endif
+};
+
+/**
+ * Aggregation statistics, see Mesh::getAggregateStats()
+ */
+struct AggregateStats {
+  uint32_t readings = 0;  // Readings contributed by this node
+  uint32_t absorbed = 0;  // Packages merged here instead of forwarded
+  uint32_t sent = 0;      // Aggregate packages send towards the sink
+  uint32_t delivered = 0;  // Aggregates handed to the application (sink only)
+  uint32_t unsent = 0;     // Packages not send, merged into the next window
+};
+
+/**
+ * Reducers and partial aggregates of one node
+ */
+class Aggregator {
+ public:
+  explicit Aggregator(uint32_t sinkId = 0) : sinkId(sinkId) {}
+
+  uint32_t sink() const { return sinkId; }
+
+  void setSink(uint32_t id) { sinkId = id; }
+
+  /**
+   * Reduce readings of key with reducers, over windows of windowMs
+   */
+  void addReducer(uint32_t key, uint8_t reducers, uint32_t windowMs,
+                  uint32_t now) {
+    auto& state = keys[key];
+    state.reducers = reducers;
+    state.partial.key = key;
+    state.partial.reducers = reducers;
+    state.windowMs = windowMs;
+    state.windowStart = now;
+  }
+
+  void removeReducer(uint32_t key) { keys.erase(key); }
+
+  bool hasReducer(uint32_t key) const { return keys.count(key) > 0; }
+
+  /**
+   * Add a reading of our own
+   *
+   * \return false if there is no reducer for the key
+   */
+  bool contribute(uint32_t key, double value, uint32_t at) {
+    auto it = keys.find(key);
+    if (it == keys.end()) return false;
+    it->second.partial.add(value, at);
+    ++stats.readings;
+    return true;
+  }
+
+  /**
+   * Merge a package on its way to the sink
+   *
+   * Only if there are reducers for all of its keys, otherwise it has to be
+   * forwarded as is.
+   *
+   * \return Whether the package was merged
+   */
+  bool absorb(const AggregatePackage& pkg) {
+    if (pkg.dest != sinkId || pkg.partials.empty()) return false;
+    for (auto&& partial : pkg.partials) {
+      if (!hasReducer(partial.key)) return false;
+    }
+    merge(pkg);
+    ++stats.absorbed;
+    return true;
+  }
+
+  /**
+   * Merge a package unconditionally, e.g. as the sink
+   */
+  void merge(const AggregatePackage& pkg) {
+    for (auto&& partial : pkg.partials) {
+      auto it = keys.find(partial.key);
+      if (it != keys.end()) it->second.partial.merge(partial);
+    }
+  }
+
+  /**
+   * Take the aggregates whose window ended
+   *
+   * Keys without readings are skipped. A new window starts for each of them.
+   */
+  std::vector<Partial> due(uint32_t now) {
+    std::vector<Partial> result;
+    for (auto&& entry : keys) {
+      auto& state = entry.second;
+      if (now - state.windowStart < state.windowMs) continue;
+      state.windowStart = now;
+      if (state.partial.count == 0) continue;
+      result.push_back(state.partial);
+      state.partial = Partial();
+      state.partial.key = entry.first;
+      state.partial.reducers = state.reducers;
+    }
+    return result;
+  }
+
+  AggregateStats stats;
+
+ protected:
+  struct State {
+    Partial partial;
+    uint8_t reducers = ALL;
+    uint32_t windowMs = 0;
+    uint32_t windowStart = 0;
+  };
+
+  uint32_t sinkId = 0;
+  std::map<uint32_t, State> keys;
+};
+
+}  // namespace aggregate
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_AGGREGATE_HPP_
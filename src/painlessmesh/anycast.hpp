@@ -0,0 +1,102 @@
+#ifndef _PAINLESS_MESH_ANYCAST_HPP_
+#define _PAINLESS_MESH_ANYCAST_HPP_
+
+/**
+ * @file anycast.hpp
+ * @brief Routing to the nearest healthy gateway
+ *
+ * Single packages with destination protocol::ANY_GATEWAY are not send to a
+ * fixed bridge. Instead every router on the way sends them towards the
+ * nearest gateway it knows to be healthy (see router::forwardAnycast()). A
+ * gateway handles them itself. If a gateway is lost, the next packages simply
+ * resolve to another one, without the sender having to notice and retry.
+ *
+ * Gateways are learned from the bridge status broadcasts.
+ */
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+
+namespace painlessmesh {
+namespace anycast {
+
+/**
+ * Anycast statistics, see Mesh::getAnycastStats()
+ */
+struct AnycastStats {
+  uint32_t forwarded = 0;   // Packages send on towards a gateway
+  uint32_t delivered = 0;   // Packages handled here, as gateway
+  uint32_t unresolved = 0;  // Packages dropped, no gateway reachable
+  size_t gateways = 0;      // Healthy gateways currently known
+};
+
+/**
+ * Gateways with Internet access, as reported by their bridge status
+ */
+class GatewayDirectory {
+ public:
+  /**
+   * Status of a bridge received
+   */
+  void seen(uint32_t nodeId, bool internetConnected, uint32_t now) {
+    if (internetConnected)
+      lastSeen[nodeId] = Entry{now, 0};
+    else
+      lastSeen.erase(nodeId);
+  }
+
+  /**
+   * Status of a bridge received, which did not change
+   *
+   * \param validMs Keep the gateway at least this long, if longer than the
+   * time out
+   */
+  void refresh(uint32_t nodeId, uint32_t now, uint32_t validMs = 0) {
+    auto it = lastSeen.find(nodeId);
+    if (it != lastSeen.end()) it->second = Entry{now, validMs};
+  }
+
+  void setTimeout(uint32_t ms) { timeoutMs = ms; }
+
+  bool isGateway(uint32_t nodeId, uint32_t now) const {
+    auto it = lastSeen.find(nodeId);
+    return it != lastSeen.end() && alive(it->second, now);
+  }
+
+  /**
+   * Gateways that reported Internet access within the time out
+   */
+  std::vector<uint32_t> gateways(uint32_t now) const {
+    std::vector<uint32_t> result;
+    for (auto&& entry : lastSeen) {
+      if (alive(entry.second, now)) result.push_back(entry.first);
+    }
+    return result;
+  }
+
+  void clear() { lastSeen.clear(); }
+
+  AnycastStats stats;
+
+ protected:
+  struct Entry {
+    uint32_t seen;
+    uint32_t validMs;
+  };
+
+  bool alive(const Entry& entry, uint32_t now) const {
+    return now - entry.seen < (std::max)(timeoutMs, entry.validMs);
+  }
+
+  uint32_t timeoutMs = 60000;
+  std::map<uint32_t, Entry> lastSeen;
+};
+
+}  // namespace anycast
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_ANYCAST_HPP_
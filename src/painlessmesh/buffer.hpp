@@ -1,6 +1,8 @@
 ﻿#ifndef _PAINLESS_MESH_BUFFER_HPP_
 #define _PAINLESS_MESH_BUFFER_HPP_
 
+#include <algorithm>
+#include <functional>
 #include <list>
 #include <map>
 #include <queue>
@@ -12,6 +14,16 @@
 #define TCP_MSS 1024
 #endif
 
+#ifndef MAX_MESSAGE_QUEUE_BYTES
+#define MAX_MESSAGE_QUEUE_BYTES 8192  // Per connection
+#endif
+#ifndef QUEUE_HIGH_WATERMARK
+#define QUEUE_HIGH_WATERMARK 75  // Percentage of the queue limits
+#endif
+#ifndef QUEUE_LOW_WATERMARK
+#define QUEUE_LOW_WATERMARK 25
+#endif
+
 namespace painlessmesh {
 namespace buffer {
 
@@ -105,6 +117,15 @@ inline void ReceiveBuffer<std::string>::stringAppend(std::string &buffer,
 }
 #endif
 
+/**
+ * What SentBuffer does with a new message when it is full
+ */
+enum DropPolicy {
+  DROP_LOWEST_PRIORITY = 0,  // Drop the oldest least important message
+  DROP_OLDEST,               // Drop the oldest message
+  REJECT_NEW                 // Refuse the new message
+};
+
 /**
  * Structure to hold a message with its priority level
  */
@@ -112,8 +133,23 @@ template <class T>
 struct PrioritizedMessage {
   T message;
   uint8_t priority;  // 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+  uint32_t deadline;  // millis() after which the message is dropped, 0=never
+  uint64_t key;       // Newer messages with the same key replace this one
   
-  PrioritizedMessage(const T& msg, uint8_t prio = 2) : message(msg), priority(prio) {}
+  PrioritizedMessage(const T& msg, uint8_t prio = 2, uint32_t deadline = 0,
+                     uint64_t key = 0)
+      : message(msg), priority(prio), deadline(deadline), key(key) {}
+};
+
+/**
+ * Messages dropped because their deadline passed, per priority
+ */
+struct ExpiryStats {
+  uint32_t critical = 0;
+  uint32_t high = 0;
+  uint32_t normal = 0;
+  uint32_t low = 0;
+  uint32_t onArrival = 0;  // Already expired when they reached us
 };
 
 /**
@@ -134,12 +170,16 @@ class SentBuffer {
    * \param priority Whether this is a high priority message (legacy bool API)
    *
    * Legacy API: High priority messages (true) will be sent to the front of the buffer
-   * This maintains backward compatibility with existing code.
+   * This maintains backward compatibility with existing code. The mesh uses
+   * them for node and time sync, so they are queued as CRITICAL and are never
+   * refused because the buffer is full.
+   *
+   * \return false if the message was dropped because the buffer is full
    */
-  void push(const T &message, bool priority = false) {
-    // Legacy API: map bool to uint8_t priority (false=2 NORMAL, true=1 HIGH)
-    uint8_t priorityLevel = priority ? 1 : 2;
-    pushWithPriority(message, priorityLevel);
+  bool push(const T &message, bool priority = false) {
+    // Legacy API: map bool to uint8_t priority (false=2 NORMAL, true=0 CRITICAL)
+    uint8_t priorityLevel = priority ? 0 : 2;
+    return pushWithPriority(message, priorityLevel);
   }
 
   /**
@@ -147,14 +187,42 @@ class SentBuffer {
    *
    * \param message The message to queue
    * \param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   * \param deadline Drop the message if it is not send before this time
+   * (millis()), 0 for no deadline
+   * \param key Coalescing key, an unsent message with the same key is replaced
+   * by this one (keeping its place in the queue). 0 for none
    *
    * Messages are scheduled in priority order. Within same priority, FIFO order is maintained.
+   *
+   * If the message does not fit within the limits (see setLimits()), room is
+   * made according to the drop policy. CRITICAL messages are never rejected:
+   * unless the policy is REJECT_NEW they replace less important messages,
+   * and if there are none they are queued beyond the limits.
+   *
+   * \return false if the new message was rejected
    */
-  void pushWithPriority(const T &message, uint8_t priorityLevel) {
+  bool pushWithPriority(const T &message, uint8_t priorityLevel,
+                        uint32_t deadline = 0, uint64_t key = 0) {
     // Clamp priority to valid range
     if (priorityLevel > 3) priorityLevel = 3;
-    
-    prioritizedMessages.push_back(PrioritizedMessage<T>(message, priorityLevel));
+
+    if (key != 0 && replace(message, priorityLevel, deadline, key)) return true;
+
+    if (!fits(message.length())) dropExpired(millis());
+    while (!fits(message.length())) {
+      // Critical messages only push out less important ones
+      if (makeRoom(priorityLevel == 0 ? 1 : priorityLevel)) continue;
+      if (priorityLevel == 0) break;
+      ++rejected;
+      return false;
+    }
+
+    prioritizedMessages.push_back(
+        PrioritizedMessage<T>(message, priorityLevel, deadline, key));
+    queuedBytes += message.length();
+    if (queuedBytes > peakBytes) peakBytes = queuedBytes;
+    if (prioritizedMessages.size() > peakMessages)
+      peakMessages = prioritizedMessages.size();
     
     // Track statistics
     totalMessagesQueued++;
@@ -164,14 +232,56 @@ class SentBuffer {
       case 2: normalQueued++; break;
       case 3: lowQueued++; break;
     }
+    checkWatermarks();
+    return true;
+  }
+
+  /**
+   * Limit the size of the buffer
+   *
+   * \param messages Maximum number of queued messages (0 is unlimited)
+   * \param bytes Maximum number of queued bytes (0 is unlimited)
+   * \param policy What to do with new messages if the buffer is full
+   */
+  void setLimits(size_t messages, size_t bytes,
+                 DropPolicy policy = DROP_LOWEST_PRIORITY) {
+    maxMessages = messages;
+    maxBytes = bytes;
+    dropPolicy = policy;
+  }
+
+  /**
+   * Called with true when the buffer fills beyond QUEUE_HIGH_WATERMARK percent
+   * of its limits, and with false when it drained below QUEUE_LOW_WATERMARK
+   */
+  void onWatermark(std::function<void(bool high)> callback) {
+    watermarkCallback = callback;
+  }
+
+  /**
+   * Fill level as percentage of the (most constraining) limit
+   */
+  uint8_t fillLevel() const {
+    size_t level = 0;
+    if (maxMessages > 0)
+      level = 100 * prioritizedMessages.size() / maxMessages;
+    if (maxBytes > 0) level = (std::max)(level, 100 * queuedBytes / maxBytes);
+    return (std::min)(level, (size_t)100);
   }
 
+  /**
+   * Number of bytes waiting to be send
+   */
+  size_t bytes() const { return queuedBytes; }
+
   /**
    * Request whether the passed length is readable
    *
    * Returns the actual length available (<= the requested length
    */
   size_t requestLength(size_t buffer_length) {
+    // Don't start sending messages nobody is interested in anymore
+    if (clean) dropExpired(millis());
     // Use highest priority message available
     auto* msg = getNextMessage();
     if (!msg)
@@ -246,17 +356,20 @@ class SentBuffer {
           case 2: normalSent++; break;
           case 3: lowSent++; break;
         }
+        queuedBytes -= (std::min)(queuedBytes, (size_t)msg.length());
         prioritizedMessages.erase(it);
         current_read_iterator = prioritizedMessages.end();  // Reset iterator
         clean = true;
       } else {
         // Partial message read, remove the read portion
+        queuedBytes -= (std::min)(queuedBytes, last_read_size);
         stringEraseFront(msg, last_read_size);
         // Keep current_read_iterator pointing to this message for next read
         clean = false;
       }
     }
     last_read_size = 0;
+    checkWatermarks();
   }
 
   bool empty() { return prioritizedMessages.empty(); }
@@ -267,6 +380,11 @@ class SentBuffer {
     totalMessagesQueued = 0;
     criticalQueued = highQueued = normalQueued = lowQueued = 0;
     criticalSent = highSent = normalSent = lowSent = 0;
+    queuedBytes = peakBytes = peakMessages = 0;
+    droppedOldest = droppedLowPriority = rejected = 0;
+    criticalExpired = highExpired = normalExpired = lowExpired = 0;
+    coalesced = 0;
+    aboveHighWatermark = false;
   }
 
   size_t size() { return prioritizedMessages.size(); }
@@ -289,6 +407,17 @@ class SentBuffer {
     uint32_t highSent;
     uint32_t normalSent;
     uint32_t lowSent;
+    size_t queuedBytes;          // Bytes currently queued
+    size_t peakBytes;            // Highest number of bytes queued
+    size_t peakMessages;         // Highest number of messages queued
+    uint32_t droppedOldest;      // Dropped by DROP_OLDEST
+    uint32_t droppedLowPriority; // Dropped by DROP_LOWEST_PRIORITY
+    uint32_t rejected;           // New messages refused
+    uint32_t criticalExpired;    // Dropped because their deadline passed
+    uint32_t highExpired;
+    uint32_t normalExpired;
+    uint32_t lowExpired;
+    uint32_t coalesced;          // Messages replaced by a newer one
   };
   
   SendStats getStats() const {
@@ -302,6 +431,17 @@ class SentBuffer {
     stats.highSent = highSent;
     stats.normalSent = normalSent;
     stats.lowSent = lowSent;
+    stats.queuedBytes = queuedBytes;
+    stats.peakBytes = peakBytes;
+    stats.peakMessages = peakMessages;
+    stats.droppedOldest = droppedOldest;
+    stats.droppedLowPriority = droppedLowPriority;
+    stats.rejected = rejected;
+    stats.criticalExpired = criticalExpired;
+    stats.highExpired = highExpired;
+    stats.normalExpired = normalExpired;
+    stats.lowExpired = lowExpired;
+    stats.coalesced = coalesced;
     return stats;
   }
 
@@ -322,6 +462,131 @@ class SentBuffer {
   uint32_t highSent = 0;
   uint32_t normalSent = 0;
   uint32_t lowSent = 0;
+
+  // Limits
+  size_t maxMessages = 0;
+  size_t maxBytes = 0;
+  DropPolicy dropPolicy = DROP_LOWEST_PRIORITY;
+  size_t queuedBytes = 0;
+  size_t peakBytes = 0;
+  size_t peakMessages = 0;
+  uint32_t droppedOldest = 0;
+  uint32_t droppedLowPriority = 0;
+  uint32_t rejected = 0;
+  uint32_t criticalExpired = 0;
+  uint32_t highExpired = 0;
+  uint32_t normalExpired = 0;
+  uint32_t lowExpired = 0;
+  uint32_t coalesced = 0;
+  bool aboveHighWatermark = false;
+  std::function<void(bool)> watermarkCallback;
+
+  bool fits(size_t length) const {
+    if (prioritizedMessages.empty()) return true;
+    if (maxMessages > 0 && prioritizedMessages.size() + 1 > maxMessages)
+      return false;
+    if (maxBytes > 0 && queuedBytes + length > maxBytes) return false;
+    return true;
+  }
+
+  /**
+   * Drop a queued message according to the drop policy
+   *
+   * The message that is partially written is never dropped, nor are messages
+   * that are more important than the new one.
+   *
+   * \return false if nothing could be dropped
+   */
+  bool makeRoom(uint8_t priorityLevel) {
+    if (dropPolicy == REJECT_NEW) return false;
+    auto victim = prioritizedMessages.end();
+    for (auto it = prioritizedMessages.begin(); it != prioritizedMessages.end();
+         ++it) {
+      if (!clean && it == current_read_iterator) continue;
+      if (it->priority < priorityLevel) continue;
+      if (dropPolicy == DROP_OLDEST) {
+        victim = it;
+        break;
+      }
+      // Oldest of the least important messages
+      if (victim == prioritizedMessages.end() ||
+          it->priority > victim->priority)
+        victim = it;
+    }
+    if (victim == prioritizedMessages.end()) return false;
+    if (dropPolicy == DROP_OLDEST)
+      ++droppedOldest;
+    else
+      ++droppedLowPriority;
+    queuedBytes -= (std::min)(queuedBytes, (size_t)victim->message.length());
+    if (victim == current_read_iterator)
+      current_read_iterator = prioritizedMessages.end();
+    prioritizedMessages.erase(victim);
+    return true;
+  }
+
+  /**
+   * Replace the queued message with the same key
+   *
+   * \return false if there is no such message (that is not already partially
+   * written)
+   */
+  bool replace(const T &message, uint8_t priorityLevel, uint32_t deadline,
+               uint64_t key) {
+    for (auto it = prioritizedMessages.begin(); it != prioritizedMessages.end();
+         ++it) {
+      if (it->key != key || (!clean && it == current_read_iterator)) continue;
+      queuedBytes -= (std::min)(queuedBytes, (size_t)it->message.length());
+      queuedBytes += message.length();
+      if (queuedBytes > peakBytes) peakBytes = queuedBytes;
+      it->message = message;
+      it->priority = priorityLevel;
+      it->deadline = deadline;
+      ++coalesced;
+      checkWatermarks();
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Remove the messages whose deadline passed
+   *
+   * The message that is partially written is kept, the other side would not
+   * be able to parse the rest otherwise.
+   */
+  void dropExpired(uint32_t now) {
+    auto it = prioritizedMessages.begin();
+    while (it != prioritizedMessages.end()) {
+      if (it->deadline == 0 || (int32_t)(now - it->deadline) < 0 ||
+          (!clean && it == current_read_iterator)) {
+        ++it;
+        continue;
+      }
+      switch (it->priority) {
+        case 0: criticalExpired++; break;
+        case 1: highExpired++; break;
+        case 2: normalExpired++; break;
+        case 3: lowExpired++; break;
+      }
+      queuedBytes -= (std::min)(queuedBytes, (size_t)it->message.length());
+      if (it == current_read_iterator)
+        current_read_iterator = prioritizedMessages.end();
+      it = prioritizedMessages.erase(it);
+    }
+  }
+
+  void checkWatermarks() {
+    if (maxMessages == 0 && maxBytes == 0) return;
+    auto level = fillLevel();
+    if (!aboveHighWatermark && level >= QUEUE_HIGH_WATERMARK) {
+      aboveHighWatermark = true;
+      if (watermarkCallback) watermarkCallback(true);
+    } else if (aboveHighWatermark && level <= QUEUE_LOW_WATERMARK) {
+      aboveHighWatermark = false;
+      if (watermarkCallback) watermarkCallback(false);
+    }
+  }
   
   /**
    * Find the highest priority message in the buffer
@@ -26,9 +26,11 @@
 // Enable OTA support
 #define PAINLESSMESH_ENABLE_OTA
 
-// Minimum free memory, besides here all packets in queue are discarded.
+// Minimum free memory, below this only critical (priority level 0) messages,
+// including node and time sync, are queued.
 #define MIN_FREE_MEMORY 4000
-// MAX number of unsent messages in queue. Newer messages are discarded
+// MAX number of unsent messages in queue per connection. See
+// Mesh::setQueueLimits() for what happens to messages that don't fit
 #define MAX_MESSAGE_QUEUE 50
 
 #define NODE_TIMEOUT 10 * TASK_SECOND
@@ -1,6 +1,7 @@
 #ifndef _PAINLESS_MESH_CONNECTION_HPP_
 #define _PAINLESS_MESH_CONNECTION_HPP_
 
+#include <cstdint>
 #include <memory>
 
 #include "Arduino.h"
@@ -14,6 +15,17 @@ extern painlessmesh::logger::LogClass Log;
 namespace painlessmesh {
 namespace tcp {
 
+/**
+ * Free heap in bytes, used to stop queueing messages before we run out
+ */
+inline size_t freeMemory() {
+#if defined(ESP32) || defined(ESP8266)
+  return ESP.getFreeHeap();
+#else
+  return SIZE_MAX;
+#endif
+}
+
 // Delay before cleaning up failed AsyncClient after connection error or close
 // This prevents crashes when AsyncTCP library is still accessing the client internally
 // The AsyncTCP library may take several hundred milliseconds to complete its internal cleanup
@@ -254,8 +266,22 @@ class BufferedConnection
     mConnected = false;
   }
 
+  /**
+   * Queue data to be send
+   *
+   * Priority data (node and time sync) is queued as critical (priority level
+   * 0 in writeWithPriority()), so neither a full queue nor low memory keeps
+   * it from being send.
+   *
+   * \return false if the data was dropped because the queue is full or
+   * (except for priority data) we are below MIN_FREE_MEMORY
+   */
   bool write(const TSTRING &data, bool priority = false) {
-    sentBuffer.push(data, priority);
+    if (!priority && freeMemory() < MIN_FREE_MEMORY) {
+      ++lowMemoryDrops;
+      return false;
+    }
+    if (!sentBuffer.push(data, priority)) return false;
     sentBufferTask.forceNextIteration();
     return true;
   }
@@ -265,13 +291,43 @@ class BufferedConnection
    * 
    * \param data The data to send
    * \param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   * \param deadline Drop the data if it is not send before this time
+   * (millis()), 0 for no deadline
+   * \param key Replace queued data with the same key, 0 for none
    */
-  bool writeWithPriority(const TSTRING &data, uint8_t priorityLevel) {
-    sentBuffer.pushWithPriority(data, priorityLevel);
+  bool writeWithPriority(const TSTRING &data, uint8_t priorityLevel,
+                         uint32_t deadline = 0, uint64_t key = 0) {
+    // Critical messages are still queued when memory is low
+    if (priorityLevel > 0 && freeMemory() < MIN_FREE_MEMORY) {
+      ++lowMemoryDrops;
+      return false;
+    }
+    if (!sentBuffer.pushWithPriority(data, priorityLevel, deadline, key))
+      return false;
     sentBufferTask.forceNextIteration();
     return true;
   }
 
+  /**
+   * Limit the send queue, see SentBuffer::setLimits()
+   */
+  void setQueueLimits(size_t messages, size_t bytes,
+                      buffer::DropPolicy policy) {
+    sentBuffer.setLimits(messages, bytes, policy);
+  }
+
+  /**
+   * Statistics of the send queue
+   */
+  buffer::SentBuffer<TSTRING>::SendStats getQueueStats() const {
+    return sentBuffer.getStats();
+  }
+
+  /**
+   * Messages that were dropped because free memory was below MIN_FREE_MEMORY
+   */
+  uint32_t getLowMemoryDrops() const { return lowMemoryDrops; }
+
   void onDisconnect(std::function<void()> callback) {
     disconnectCallback = callback;
   }
@@ -282,6 +338,11 @@ class BufferedConnection
 
   bool connected() { return mConnected; }
 
+  /**
+   * Number of messages waiting to be send
+   */
+  size_t queueSize() { return sentBuffer.size(); }
+
  protected:
   bool mConnected = true;
 
@@ -293,6 +354,7 @@ class BufferedConnection
 
   painlessmesh::buffer::ReceiveBuffer<TSTRING> receiveBuffer;
   painlessmesh::buffer::SentBuffer<TSTRING> sentBuffer;
+  uint32_t lowMemoryDrops = 0;
 
   bool writeNext() {
     if (sentBuffer.empty()) {
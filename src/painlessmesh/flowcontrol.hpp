@@ -0,0 +1,201 @@
+#ifndef _PAINLESS_MESH_FLOWCONTROL_HPP_
+#define _PAINLESS_MESH_FLOWCONTROL_HPP_
+
+/**
+ * @file flowcontrol.hpp
+ * @brief Flow control for single messages
+ *
+ * A node that sends faster than the path to the destination can carry fills
+ * the send queues of every relay along that path. To avoid this, relays whose
+ * queue towards the destination grows beyond FLOW_CONTROL_THRESHOLD send
+ * credit feedback (a suggested window) back to the original sender. The sender
+ * then limits the number of messages it sends to that destination per
+ * FLOW_CONTROL_INTERVAL. The window is halved on feedback and grows by one
+ * every interval without feedback (AIMD), until the limit is lifted again.
+ *
+ * Nodes that never receive feedback are not limited at all.
+ */
+
+#include <algorithm>
+#include <map>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/protocol.hpp"
+
+#ifndef FLOW_CONTROL_THRESHOLD
+#define FLOW_CONTROL_THRESHOLD (MAX_MESSAGE_QUEUE / 2)  // Queued messages
+#endif
+#ifndef FLOW_CONTROL_INTERVAL
+#define FLOW_CONTROL_INTERVAL 1000  // ms
+#endif
+#ifndef FLOW_CONTROL_FEEDBACK_INTERVAL
+#define FLOW_CONTROL_FEEDBACK_INTERVAL 250  // ms between feedback to a sender
+#endif
+#ifndef FLOW_CONTROL_MIN_WINDOW
+#define FLOW_CONTROL_MIN_WINDOW 1
+#endif
+#ifndef FLOW_CONTROL_MAX_WINDOW
+#define FLOW_CONTROL_MAX_WINDOW 32  // Messages per interval
+#endif
+
+namespace painlessmesh {
+namespace flowcontrol {
+
+/**
+ * Credit feedback from a congested relay
+ *
+ * Type ID: 660 (FLOW_CONTROL)
+ * Routing: SINGLE, to the sender of the message that was queued
+ */
+class CreditPackage : public protocol::PackageInterface {
+ public:
+  int type = protocol::FLOW_CONTROL;
+  uint32_t from = 0;    // Relay that is congested
+  uint32_t dest = 0;    // Sender that should slow down
+  uint32_t node = 0;    // Destination the sender was sending to
+  uint16_t queue = 0;   // Queue length at the relay
+  uint16_t window = FLOW_CONTROL_MIN_WINDOW;  // Suggested messages/interval
+
+  CreditPackage() {}
+
+  CreditPackage(JsonObject jsonObj) {
+    from = jsonObj["from"].as<uint32_t>();
+    dest = jsonObj["dest"].as<uint32_t>();
+    node = jsonObj["node"].as<uint32_t>();
+    queue = jsonObj["queue"].as<uint16_t>();
+    window = jsonObj["window"].as<uint16_t>();
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj["type"] = type;
+    jsonObj["routing"] = static_cast<int>(router::SINGLE);
+    jsonObj["from"] = from;
+    jsonObj["dest"] = dest;
+    jsonObj["node"] = node;
+    jsonObj["queue"] = queue;
+    jsonObj["window"] = window;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const { return JSON_OBJECT_SIZE(7); }
+#endif
+};
+
+/**
+ * Window a relay suggests, given the length of its queue
+ */
+inline uint16_t suggestedWindow(size_t queue) {
+  size_t limit = MAX_MESSAGE_QUEUE;
+  size_t window = queue < limit ? (limit - queue) / 2 : 0;
+  if (window < FLOW_CONTROL_MIN_WINDOW) window = FLOW_CONTROL_MIN_WINDOW;
+  if (window > FLOW_CONTROL_MAX_WINDOW) window = FLOW_CONTROL_MAX_WINDOW;
+  return window;
+}
+
+/**
+ * Whether a relay should send feedback about this (forwarded) package
+ *
+ * Only application data is limited, control traffic is never held back.
+ */
+inline bool isFlowControlled(int type) {
+  return type == protocol::SINGLE || type == protocol::RELIABLE_DATA;
+}
+
+/**
+ * Flow control statistics, see Mesh::getFlowControlStats()
+ */
+struct FlowControlStats {
+  uint32_t feedbackReceived = 0;  // Credit packages received as a sender
+  uint32_t throttled = 0;         // Messages refused because of the window
+  size_t limited = 0;             // Destinations currently limited
+};
+
+/**
+ * Send windows per destination, on the sending side
+ */
+class FlowWindow {
+ public:
+  /**
+   * Take one message from the window towards destId
+   *
+   * \return false if the window for the current interval is used up
+   */
+  bool tryAcquire(uint32_t destId, uint32_t now) {
+    auto it = windows.find(destId);
+    if (it == windows.end()) return true;
+    auto& state = it->second;
+    while (now - state.intervalStart >= FLOW_CONTROL_INTERVAL) {
+      // Additive increase
+      state.intervalStart += FLOW_CONTROL_INTERVAL;
+      state.used = 0;
+      if (++state.window >= FLOW_CONTROL_MAX_WINDOW) {
+        windows.erase(it);
+        return true;
+      }
+    }
+    if (state.used >= state.window) {
+      ++stats.throttled;
+      return false;
+    }
+    ++state.used;
+    return true;
+  }
+
+  /**
+   * Feedback that the path towards destId is congested
+   */
+  void onCredit(uint32_t destId, uint16_t suggested, uint32_t now) {
+    ++stats.feedbackReceived;
+    auto it = windows.find(destId);
+    if (it == windows.end()) {
+      State state;
+      state.intervalStart = now;
+      state.lastDecrease = now;
+      state.window = std::max((uint16_t)(FLOW_CONTROL_MIN_WINDOW),
+                              std::min((uint16_t)(FLOW_CONTROL_MAX_WINDOW / 2),
+                                       suggested));
+      windows[destId] = state;
+      return;
+    }
+    auto& state = it->second;
+    // Multiplicative decrease, at most once per interval, because feedback
+    // about messages send before the last decrease can still be underway
+    if (now - state.lastDecrease < FLOW_CONTROL_INTERVAL) return;
+    state.lastDecrease = now;
+    state.window = std::max(
+        (uint16_t)(FLOW_CONTROL_MIN_WINDOW),
+        std::min((uint16_t)(state.window / 2), suggested));
+  }
+
+  /**
+   * Current window towards destId, FLOW_CONTROL_MAX_WINDOW if not limited
+   */
+  uint16_t window(uint32_t destId) const {
+    auto it = windows.find(destId);
+    if (it == windows.end()) return FLOW_CONTROL_MAX_WINDOW;
+    return it->second.window;
+  }
+
+  size_t size() const { return windows.size(); }
+
+  void clear() { windows.clear(); }
+
+  FlowControlStats stats;
+
+ protected:
+  struct State {
+    uint16_t window = FLOW_CONTROL_MAX_WINDOW;
+    uint16_t used = 0;
+    uint32_t intervalStart = 0;
+    uint32_t lastDecrease = 0;
+  };
+
+  std::map<uint32_t, State> windows;
+};
+
+}  // namespace flowcontrol
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_FLOWCONTROL_HPP_
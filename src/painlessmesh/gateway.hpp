@@ -764,13 +764,22 @@ class GatewayDataPackage : public plugin::SinglePackage {
    */
   bool requiresAck = false;
 
+  /**
+   * @brief Sequence number per origin node, 0 if not striped
+   *
+   * Requests striped over several gateways can reach the destination out of
+   * order. The gateway passes this on as X-Mesh-Sequence header, so the
+   * destination can restore the order (see striping::ReorderBuffer).
+   */
+  uint32_t sequence = 0;
+
   /**
    * @brief Number of additional JSON fields in this package
    *
    * Used for jsonObjectSize() calculation in ArduinoJson v6.
-   * Count: msgId, origin, ts, prio, dest_url, payload, content, retry, ack = 9 fields
+   * Count: msgId, origin, ts, prio, dest_url, payload, content, retry, ack, seq = 10 fields
    */
-  static constexpr int numPackageFields = 9;
+  static constexpr int numPackageFields = 10;
 
   /**
    * @brief Default constructor
@@ -794,6 +803,7 @@ class GatewayDataPackage : public plugin::SinglePackage {
     priority = jsonObj["prio"];
     retryCount = jsonObj["retry"];
     requiresAck = jsonObj["ack"] | false;
+    sequence = jsonObj["seq"] | 0;
 
 #if ARDUINOJSON_VERSION_MAJOR < 7
     if (jsonObj.containsKey("dest_url"))
@@ -831,6 +841,7 @@ class GatewayDataPackage : public plugin::SinglePackage {
     jsonObj["content"] = contentType;
     jsonObj["retry"] = retryCount;
     jsonObj["ack"] = requiresAck;
+    if (sequence != 0) jsonObj["seq"] = sequence;
     return jsonObj;
   }
 
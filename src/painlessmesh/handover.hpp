@@ -0,0 +1,156 @@
+#ifndef _PAINLESS_MESH_HANDOVER_HPP_
+#define _PAINLESS_MESH_HANDOVER_HPP_
+
+/**
+ * @file handover.hpp
+ * @brief Keep serving the subtree while a node looks for a new parent
+ *
+ * When a node with children loses its parent, announcing the change right
+ * away makes every node in the subtree update its layout, and often rescan
+ * or drop its own parent as well. Usually the node finds a new parent within
+ * seconds, after which everything changes again.
+ *
+ * Instead the node keeps its children and their view of the mesh as is for up
+ * to HANDOVER_TIMEOUT. Messages from the subtree that would have gone
+ * upstream are held in a bounded buffer and sent on once a new parent is
+ * found. The new parent connection then leads to a single node sync with the
+ * subtree. If no parent is found in time, the change is announced after all
+ * and the held messages are dropped.
+ */
+
+#include <list>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+
+#ifndef HANDOVER_TIMEOUT
+#define HANDOVER_TIMEOUT 30 * TASK_SECOND  // Max time to find a new parent
+#endif
+#ifndef HANDOVER_QUEUE_SIZE
+#define HANDOVER_QUEUE_SIZE 20  // Messages held for the new parent
+#endif
+#ifndef HANDOVER_QUEUE_BYTES
+#define HANDOVER_QUEUE_BYTES 4096  // Bytes held for the new parent
+#endif
+
+namespace painlessmesh {
+namespace handover {
+
+/**
+ * Handover statistics, see Mesh::getHandoverStats()
+ */
+struct HandoverStats {
+  uint32_t started = 0;    // Times we lost our parent while having children
+  uint32_t recovered = 0;  // ... and found a new one within HANDOVER_TIMEOUT
+  uint32_t timedOut = 0;   // ... and didn't
+  uint32_t held = 0;       // Upstream messages held during handovers
+  uint32_t flushed = 0;    // Held messages send on to the new parent
+  uint32_t dropped = 0;    // Held messages lost (full, expired or timed out)
+  uint32_t lastDurationMs = 0;  // Time without parent during last handover
+};
+
+/**
+ * A message held while there is no parent
+ */
+struct HeldMessage {
+  TSTRING msg;
+  uint32_t dest = 0;      // 0 for broadcasts
+  uint32_t deadline = 0;  // millis(), 0 for none
+};
+
+/**
+ * Upstream messages held during a handover
+ */
+class HandoverBuffer {
+ public:
+  /**
+   * Start a handover
+   *
+   * \return Identifies this handover, to recognise its time out
+   */
+  uint32_t start(uint32_t parentId, uint32_t now) {
+    running = true;
+    parent = parentId;
+    startedAt = now;
+    ++stats.started;
+    return ++generation;
+  }
+
+  bool active() const { return running; }
+
+  bool isCurrent(uint32_t id) const { return running && id == generation; }
+
+  /// The parent that was lost
+  uint32_t lostParent() const { return parent; }
+
+  /**
+   * Hold an upstream message until we have a parent again
+   *
+   * When the buffer is full the oldest messages are dropped.
+   */
+  bool hold(const TSTRING& msg, uint32_t dest, uint32_t deadline) {
+    if (!running || msg.length() > HANDOVER_QUEUE_BYTES) return false;
+    while (!messages.empty() &&
+           (messages.size() >= HANDOVER_QUEUE_SIZE ||
+            bytes + msg.length() > HANDOVER_QUEUE_BYTES)) {
+      bytes -= messages.front().msg.length();
+      messages.pop_front();
+      ++stats.dropped;
+    }
+    HeldMessage held;
+    held.msg = msg;
+    held.dest = dest;
+    held.deadline = deadline;
+    messages.push_back(held);
+    bytes += msg.length();
+    ++stats.held;
+    return true;
+  }
+
+  /**
+   * End the handover
+   *
+   * \param recovered Whether we found a new parent
+   *
+   * \return The held messages that have not expired, to be send on. Empty if
+   * we didn't recover.
+   */
+  std::list<HeldMessage> finish(bool recovered, uint32_t now) {
+    std::list<HeldMessage> result;
+    if (!running) return result;
+    running = false;
+    stats.lastDurationMs = now - startedAt;
+    if (recovered)
+      ++stats.recovered;
+    else
+      ++stats.timedOut;
+    for (auto&& held : messages) {
+      if (!recovered ||
+          (held.deadline != 0 && (int32_t)(held.deadline - now) <= 0)) {
+        ++stats.dropped;
+        continue;
+      }
+      result.push_back(held);
+    }
+    messages.clear();
+    bytes = 0;
+    return result;
+  }
+
+  size_t size() const { return messages.size(); }
+
+  HandoverStats stats;
+
+ protected:
+  bool running = false;
+  uint32_t parent = 0;
+  uint32_t startedAt = 0;
+  uint32_t generation = 0;
+  size_t bytes = 0;
+  std::list<HeldMessage> messages;
+};
+
+}  // namespace handover
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_HANDOVER_HPP_
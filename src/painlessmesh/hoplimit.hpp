@@ -0,0 +1,105 @@
+#ifndef _PAINLESS_MESH_HOPLIMIT_HPP_
+#define _PAINLESS_MESH_HOPLIMIT_HPP_
+
+/**
+ * @file hoplimit.hpp
+ * @brief Bound the number of hops a package travels
+ *
+ * The mesh is a tree, so normally a package can't loop. While the layout
+ * changes, two nodes can briefly disagree on it though, and a broadcast can
+ * then circulate and multiply until the loop is noticed. To bound this,
+ * routed packages carry a hop limit ("ttl"), the number of hops they may
+ * still travel:
+ *
+ * - The first relay (the second node on the way) sets it from the limit of
+ *   the package type. Senders don't add it, so packages to neighbours don't
+ *   grow.
+ * - Every further relay decrements it.
+ * - A package that arrives with no hops left is still handled, but not
+ *   forwarded.
+ *
+ * From the hops left the receiver also knows the hops a package travelled,
+ * see HopStats. This assumes all nodes use the same limits. Packages without
+ * hop limit (from a neighbour or from older nodes) count as a single hop.
+ */
+
+#include <map>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+
+#ifndef HOP_LIMIT_DEFAULT
+#define HOP_LIMIT_DEFAULT 32  // Hops for package types without their own limit
+#endif
+
+namespace painlessmesh {
+namespace hoplimit {
+
+/**
+ * Hop statistics, see Mesh::getHopStats()
+ */
+struct HopStats {
+  uint32_t received = 0;   // Routed packages received
+  uint32_t totalHops = 0;  // Hops travelled by them
+  uint16_t maxHops = 0;    // Most hops travelled by one of them
+  uint32_t exhausted = 0;  // Packages not forwarded because no hops were left
+
+  float averageHops() const {
+    return received > 0 ? (float)totalHops / received : 0;
+  }
+};
+
+/**
+ * Hop limits per package type
+ */
+class HopLimits {
+ public:
+  /**
+   * Limit the hops of a package type
+   *
+   * \param hops Hops, 0 restores HOP_LIMIT_DEFAULT
+   */
+  void setLimit(int type, uint8_t hops) {
+    if (hops == 0)
+      limits.erase(type);
+    else
+      limits[type] = hops;
+  }
+
+  uint8_t limit(int type) const {
+    auto it = limits.find(type);
+    if (it == limits.end()) return HOP_LIMIT_DEFAULT;
+    return it->second;
+  }
+
+  /**
+   * Count a received package and decide the hops it has left
+   *
+   * \param ttl Hops left in the package, -1 if it has none
+   *
+   * \return Hops left to put in the package when forwarding it, -1 if it
+   * can't be forwarded
+   */
+  int received(int type, int ttl) {
+    auto max = limit(type);
+    uint16_t hops = 1;
+    if (ttl >= 0) hops = ttl < max ? max - ttl : 1;
+    ++stats.received;
+    stats.totalHops += hops;
+    if (hops > stats.maxHops) stats.maxHops = hops;
+
+    int left = ttl < 0 ? max - 1 : ttl;
+    if (left <= 0) return -1;
+    return left - 1;
+  }
+
+  HopStats stats;
+
+ protected:
+  std::map<int, uint8_t> limits;
+};
+
+}  // namespace hoplimit
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_HOPLIMIT_HPP_
@@ -1,8 +1,11 @@
 #ifndef _PAINLESS_MESH_LAYOUT_HPP_
 #define _PAINLESS_MESH_LAYOUT_HPP_
 
+#include <algorithm>
 #include <list>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include "painlessmesh/protocol.hpp"
 
@@ -84,6 +87,22 @@ class Neighbour : public protocol::NodeTree {
   // Inherit constructors
   using protocol::NodeTree::NodeTree;
 
+  // Topics subscribed to by the nodes behind this neighbour (sorted), as
+  // advertised during the last node sync
+  std::vector<uint32_t> topics;
+  bool topicsKnown = false;
+  // Topic messages not send to this neighbour, because nobody behind it
+  // subscribed to the topic
+  uint32_t suppressedTopicMessages = 0;
+
+  /**
+   * Whether any node behind this neighbour might be subscribed to the topic
+   */
+  bool wantsTopic(uint32_t topic) const {
+    if (!topicsKnown) return true;
+    return std::binary_search(topics.begin(), topics.end(), topic);
+  }
+
   /**
    * Is the passed nodesync valid
    *
@@ -142,6 +161,18 @@ class Neighbour : public protocol::NodeTree {
   }
 };
 
+/**
+ * Hops from the top of the tree to the given node, -1 if it is not in the tree
+ */
+inline int depthOf(const protocol::NodeTree& nodeTree, uint32_t nodeId) {
+  if (nodeTree.nodeId == nodeId) return 0;
+  for (auto&& s : nodeTree.subs) {
+    auto depth = depthOf(s, nodeId);
+    if (depth >= 0) return depth + 1;
+  }
+  return -1;
+}
+
 /**
  * The size of the mesh (the number of nodes)
  */
@@ -185,6 +216,110 @@ inline std::list<uint32_t> asList(protocol::NodeTree nodeTree,
   return lst;
 }
 
+/**
+ * Position of a node in the mesh
+ */
+struct NodePosition {
+  uint16_t depth = 0;        // Hops to the root (or the top of the tree)
+  uint16_t connections = 0;  // Direct neighbours (parent and children)
+  uint32_t subtree = 1;      // Nodes at or below this node, seen from the root
+  uint32_t branch = 0;  // Nodes in the branch of the root this node is in
+  uint32_t branchId = 0;  // First node on the path from the root to this node
+};
+
+inline void addEdges(const protocol::NodeTree& nodeTree,
+                     std::map<uint32_t, std::vector<uint32_t>>& edges) {
+  edges[nodeTree.nodeId];
+  for (auto&& s : nodeTree.subs) {
+    edges[nodeTree.nodeId].push_back(s.nodeId);
+    edges[s.nodeId].push_back(nodeTree.nodeId);
+    addEdges(s, edges);
+  }
+}
+
+inline uint32_t findRoot(const protocol::NodeTree& nodeTree) {
+  if (nodeTree.root) return nodeTree.nodeId;
+  for (auto&& s : nodeTree.subs) {
+    auto id = findRoot(s);
+    if (id != 0) return id;
+  }
+  return 0;
+}
+
+/**
+ * Position of every node in the tree, as seen from the root
+ *
+ * Every node only knows the tree as seen from itself, so the tree is first
+ * turned around to start at the root. If the mesh has no root the top of the
+ * given tree is used instead.
+ */
+inline std::map<uint32_t, NodePosition> positions(
+    const protocol::NodeTree& nodeTree) {
+  std::map<uint32_t, std::vector<uint32_t>> edges;
+  addEdges(nodeTree, edges);
+  auto top = findRoot(nodeTree);
+  if (top == 0) top = nodeTree.nodeId;
+
+  std::map<uint32_t, NodePosition> pos;
+  std::map<uint32_t, uint32_t> parent;
+  std::vector<uint32_t> order;
+  order.push_back(top);
+  pos[top].connections = edges[top].size();
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto id = order[i];
+    for (auto&& next : edges[id]) {
+      if (pos.count(next)) continue;
+      auto& p = pos[next];
+      p.depth = pos[id].depth + 1;
+      p.connections = edges[next].size();
+      parent[next] = id;
+      order.push_back(next);
+    }
+  }
+
+  // Children come after their parent, so walk back to count the subtrees
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    if (*it == top) continue;
+    pos[parent[*it]].subtree += pos[*it].subtree;
+  }
+  for (auto&& id : order) {
+    if (id == top) continue;
+    auto up = parent[id];
+    pos[id].branch = up == top ? pos[id].subtree : pos[up].branch;
+    pos[id].branchId = up == top ? id : pos[up].branchId;
+  }
+  return pos;
+}
+
+/**
+ * Shape of the mesh, see Mesh::getTopologyStats()
+ */
+struct TopologyStats {
+  uint32_t nodes = 0;
+  uint32_t rootId = 0;          // 0 if the mesh has no root
+  uint16_t maxHops = 0;         // Hops from the root to the deepest node
+  float averageHops = 0;        // Average hops from a node to the root
+  uint16_t rootLinks = 0;       // Direct connections of the root
+  uint32_t largestBranch = 0;   // Nodes behind the busiest root connection
+};
+
+inline TopologyStats topologyStats(const protocol::NodeTree& nodeTree) {
+  TopologyStats stats;
+  stats.rootId = findRoot(nodeTree);
+  auto pos = positions(nodeTree);
+  stats.nodes = pos.size();
+  uint32_t hops = 0;
+  for (auto&& p : pos) {
+    hops += p.second.depth;
+    if (p.second.depth > stats.maxHops) stats.maxHops = p.second.depth;
+    if (p.second.depth == 0) stats.rootLinks = p.second.connections;
+    if (p.second.branch > stats.largestBranch)
+      stats.largestBranch = p.second.branch;
+  }
+  if (stats.nodes > 1) stats.averageHops = (float)hops / (stats.nodes - 1);
+  return stats;
+}
+
 }  // namespace layout
 }  // namespace painlessmesh
 
@@ -8,18 +8,30 @@
 #include <set>
 #include <queue>
 
+#include "painlessmesh/aggregate.hpp"
+#include "painlessmesh/anycast.hpp"
 #include "painlessmesh/configuration.hpp"
 
 #include "painlessmesh/connection.hpp"
+#include "painlessmesh/flowcontrol.hpp"
 #include "painlessmesh/gateway.hpp"
+#include "painlessmesh/handover.hpp"
+#include "painlessmesh/hoplimit.hpp"
 #include "painlessmesh/logger.hpp"
 #include "painlessmesh/message_queue.hpp"
 #include "painlessmesh/message_tracker.hpp"
 #include "painlessmesh/ntp.hpp"
 #include "painlessmesh/plugin.hpp"
+#include "painlessmesh/striping.hpp"
 #include "painlessmesh/protocol.hpp"
+#include "painlessmesh/pubsub.hpp"
+#include "painlessmesh/ratelimit.hpp"
+#include "painlessmesh/reliable.hpp"
+#include "painlessmesh/rpc.hpp"
 #include "painlessmesh/rtc.hpp"
+#include "painlessmesh/slots.hpp"
 #include "painlessmesh/tcp.hpp"
+#include "painlessmesh/validation.hpp"
 
 #ifdef PAINLESSMESH_ENABLE_OTA
 #include "painlessmesh/ota.hpp"
@@ -36,6 +48,14 @@ typedef std::function<void(uint32_t bridgeNodeId, bool internetAvailable)> bridg
 typedef std::function<void(uint32_t timestamp)> rtcSyncCompleteCallback_t;
 typedef std::function<void(bool available)> localInternetChangedCallback_t;
 typedef std::function<void(uint32_t oldPrimary, uint32_t newPrimary)> gatewayChangedCallback_t;
+typedef std::function<void(uint32_t from, TSTRING &topic, TSTRING &msg)>
+    topicReceivedCallback_t;
+typedef std::function<void(uint32_t destId, uint32_t seq, bool delivered)>
+    reliableDeliveryCallback_t;
+typedef std::function<void(uint32_t nodeId, bool high)>
+    queueWatermarkCallback_t;
+typedef std::function<void(const aggregate::Partial &aggregate)>
+    aggregateCallback_t;
 
 /**
  * Callback type for Internet request results
@@ -61,6 +81,7 @@ struct PendingInternetRequest {
   uint32_t timeoutMs = 30000;      ///< Timeout in milliseconds
   uint32_t retryDelayMs = 1000;    ///< Current retry delay (for exponential backoff)
   uint32_t gatewayNodeId = 0;      ///< Target gateway node ID
+  uint32_t sequence = 0;           ///< Stripe sequence number (0 if not striped)
   TSTRING destination = "";        ///< Internet destination URL
   TSTRING payload = "";            ///< Request payload
   internetResultCallback_t callback;  ///< User callback for result
@@ -88,15 +109,19 @@ public:
   uint32_t uptime = 0;             // Bridge uptime in milliseconds
   TSTRING gatewayIP = "";          // Router gateway IP address
   uint32_t timestamp = 0;          // Timestamp from bridge status message
+  uint8_t capacity = 0;            // Advertised uplink capacity, 0 if unknown
+  uint32_t nextMs = 0;             // Announced ms until its next keepalive, 0 if unknown
   
   /**
    * Check if this bridge is considered healthy
-   * A bridge is healthy if we've received a status update within the timeout period
+   * A bridge is healthy if we've received a status update within the timeout period,
+   * or within twice the time it announced for its next keepalive if that is longer
    */
   bool isHealthy(uint32_t timeoutMs = 60000) const {
     // Cast millis() to uint32_t to handle overflow correctly
     // This ensures consistent behavior on both embedded and test environments
-    return (static_cast<uint32_t>(millis()) - lastSeen) < timeoutMs;
+    return (static_cast<uint32_t>(millis()) - lastSeen) <
+           (std::max)(timeoutMs, 2 * nextMs);
   }
 };
 
@@ -216,29 +241,19 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     this->callbackList.onPackage(
         protocol::BRIDGE_STATUS,
         [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
-          // We need to manually parse the JSON since BridgeStatusPackage is in alteriom namespace
-          // and may not be available in all contexts. We'll parse the critical fields directly.
-          JsonDocument doc;
-          TSTRING str;
-          variant.printTo(str);
-          deserializeJson(doc, str);
-          JsonObject obj = doc.as<JsonObject>();
-          
-          if (obj["internetConnected"].is<bool>()) {
-            uint32_t bridgeNodeId = obj["from"];
-            bool internetConnected = obj["internetConnected"];
-            int8_t routerRSSI = obj["routerRSSI"] | 0;
-            uint8_t routerChannel = obj["routerChannel"] | 0;
-            uint32_t uptime = obj["uptime"] | 0;
-            TSTRING gatewayIP = obj["gatewayIP"].as<TSTRING>();
-            uint32_t timestamp = obj["timestamp"] | 0;
-            
-            // Update bridge status
-            this->updateBridgeStatus(bridgeNodeId, internetConnected, routerRSSI, 
-                                    routerChannel, uptime, gatewayIP, timestamp);
-            
+          // Read the fields straight from the already parsed package
+          auto pkg = variant.to<plugin::BridgeStatusPackage>();
+          if (pkg.unchanged) {
+            // Keepalive, the bridge is still there and nothing changed
+            this->refreshBridge(pkg.from, pkg.next);
+          } else if (pkg.hasStatus) {
+            this->updateBridgeStatus(pkg.from, pkg.internetConnected,
+                                     pkg.routerRSSI, pkg.routerChannel,
+                                     pkg.uptime, pkg.gatewayIP, pkg.timestamp,
+                                     pkg.capacity);
+
             Log(GENERAL, "Bridge status received from %u: Internet %s\n",
-                bridgeNodeId, internetConnected ? "Connected" : "Disconnected");
+                pkg.from, pkg.internetConnected ? "Connected" : "Disconnected");
           }
           return false;  // Don't consume the package, allow other handlers
         });
@@ -253,9 +268,119 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       this->metricsDisconnectCount++;
       this->eraseClosedConnections();
     });
-    this->newConnectionCallbacks.push_back([](uint32_t nodeId) {
+    this->newConnectionCallbacks.push_back([this](uint32_t nodeId) {
       Log(MESH_STATUS, "New connection %u\n", nodeId);
+      if (this->handover.active()) this->finishHandover(nodeId);
+    });
+
+    // Transmission slot assigned by the root
+    this->callbackList.onPackage(
+        protocol::TRANSMIT_SLOT,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          auto pkg = variant.to<slots::SlotAssignmentPackage>();
+          if (pkg.dest != this->nodeId || pkg.slotCount == 0) return false;
+          this->transmitSlot = pkg.slot % pkg.slotCount;
+          this->transmitSlotCount = pkg.slotCount;
+          this->transmitSlotAssigned = true;
+          Log(GENERAL, "Transmit slot %u/%u assigned by %u\n",
+              this->transmitSlot, this->transmitSlotCount, pkg.from);
+          return false;
+        });
+    // Messages published on a topic
+    this->callbackList.onPackage(
+        protocol::PUBLISH,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          this->deliverTopic(variant);
+          return false;
+        });
+
+    // Reliable messages, acknowledge and pass on to onReceive() once
+    this->callbackList.onPackage(
+        protocol::RELIABLE_DATA,
+        [this](protocol::Variant& variant, std::shared_ptr<T> conn,
+               uint32_t receivedAt) {
+          auto pkg = variant.to<reliable::ReliablePackage>();
+          reliable::ReliableAckPackage ack;
+          auto isNew =
+              this->reliableReceiver.receive(pkg, this->nodeId, millis(), ack);
+          this->sendPackage(&ack);
+          if (isNew) {
+            protocol::Single single(pkg.from, pkg.dest, pkg.msg);
+            protocol::Variant var(single);
+            this->callbackList.execute(var.type(), var, conn, receivedAt);
+          } else {
+            Log(COMMUNICATION, "Dropped duplicate reliable message %u from %u\n",
+                pkg.seq, pkg.from);
+          }
+          return false;
+        });
+    // Relay asking us to slow down
+    this->callbackList.onPackage(
+        protocol::FLOW_CONTROL,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          auto pkg = variant.to<flowcontrol::CreditPackage>();
+          Log(COMMUNICATION, "Flow control from %u: to %u window %u\n",
+              pkg.from, pkg.node, pkg.window);
+          this->flowWindow.onCredit(pkg.node, pkg.window, millis());
+          return false;
+        });
+    // Aggregates for which we are the sink
+    this->callbackList.onPackage(
+        protocol::AGGREGATE,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          if (this->aggregator)
+            this->aggregator->merge(
+                variant.to<aggregate::AggregatePackage>());
+          return false;
+        });
+    // Calls of our methods
+    this->callbackList.onPackage(
+        protocol::RPC_REQUEST,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          auto pkg = variant.to<rpc::RequestPackage>();
+          rpc::ResponsePackage response;
+          response.from = this->nodeId;
+          response.dest = pkg.from;
+          response.id = pkg.id;
+          auto method = this->rpcMethods.find(pkg.method);
+          if (method == this->rpcMethods.end()) {
+            ++this->rpcCalls.stats.unknown;
+            response.status = rpc::UNKNOWN_METHOD;
+          } else {
+            ++this->rpcCalls.stats.served;
+            response.status =
+                method->second(pkg.from, pkg.params, response.result);
+          }
+          this->sendPackage(&response);
+          return false;
+        });
+    this->callbackList.onPackage(
+        protocol::RPC_RESPONSE,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          this->rpcCalls.complete(variant.to<rpc::ResponsePackage>());
+          return false;
+        });
+    this->callbackList.onPackage(
+        protocol::RELIABLE_ACK,
+        [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
+          auto pkg = variant.to<reliable::ReliableAckPackage>();
+          auto acked = this->reliableSender.onAck(pkg, millis());
+          for (auto&& seq : acked) {
+            if (this->reliableDeliveryCallback)
+              this->reliableDeliveryCallback(pkg.from, seq, true);
+          }
+          return false;
+        });
+
+    this->changedConnectionCallbacks.push_back([this](uint32_t) {
+      if (this->slotAssignmentEnabled && this->isRoot())
+        this->assignTransmitSlots();
     });
+
+    // Keep track of mesh time roll overs, also when nothing else asks for
+    // the time for a while
+    this->addTask(10 * TASK_MINUTE, TASK_FOREVER,
+                  [this]() { this->getNodeTime64(); });
   }
 
   void init(Scheduler *scheduler, uint32_t id) {
@@ -345,6 +470,11 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       this->eraseClosedConnections();
     }
     plugin::PackageHandler<T>::stop();
+    reliableTask = nullptr;
+    aggregateTask = nullptr;
+    rpcTask = nullptr;
+    slotRefreshTask = nullptr;
+    this->handover.finish(false, millis());
 
     newConnectionCallbacks.clear();
     droppedConnectionCallbacks.clear();
@@ -381,6 +511,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
   bool sendSingle(uint32_t destId, TSTRING msg) {
     Log(logger::COMMUNICATION, "sendSingle(): dest=%u msg=%s\n", destId,
         msg.c_str());
+    if (!acquireSendWindow(destId)) return false;
     auto single = painlessmesh::protocol::Single(this->nodeId, destId, msg);
     return painlessmesh::router::send<T>(single, (*this));
   }
@@ -396,12 +527,325 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
   bool sendSingle(uint32_t destId, TSTRING msg, uint8_t priorityLevel) {
     Log(logger::COMMUNICATION, "sendSingle(): dest=%u msg=%s priority=%u\n", destId,
         msg.c_str(), priorityLevel);
-    auto single = painlessmesh::protocol::Single(this->nodeId, destId, msg);
     auto conn = painlessmesh::router::findRoute<T>((*this), destId);
     if (!conn) return false;
+    // Critical messages are never held back
+    if (priorityLevel > 0 && !acquireSendWindow(destId)) return false;
+    auto single = painlessmesh::protocol::Single(this->nodeId, destId, msg);
     return painlessmesh::router::sendWithPriority<painlessmesh::protocol::Single, T>(single, conn, priorityLevel);
   }
 
+  /** Send message to a specific node, unless it can't get there in time
+   *
+   * The message carries a deadline in mesh time. If it is still queued
+   * somewhere (here or on a relay) when the deadline passes, it is dropped
+   * instead of send, so the bandwidth goes to fresh data.
+   *
+   * @param destId The nodeId of the node to send it to.
+   * @param msg The message to send
+   * @param ttlMs Time the message stays useful in milliseconds
+   * @param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   *
+   * @return true if the message was queued
+   */
+  bool sendSingleWithDeadline(uint32_t destId, TSTRING msg, uint32_t ttlMs,
+                              uint8_t priorityLevel = 2) {
+    Log(logger::COMMUNICATION, "sendSingleWithDeadline(): dest=%u ttl=%u\n",
+        destId, ttlMs);
+    auto conn = painlessmesh::router::findRoute<T>((*this), destId);
+    if (!conn) return false;
+    if (priorityLevel > 0 && !acquireSendWindow(destId)) return false;
+    auto single = painlessmesh::protocol::Single(this->nodeId, destId, msg);
+    single.deadline = this->getNodeTime() + ttlMs * 1000;
+    if (single.deadline == 0) single.deadline = 1;
+    protocol::Variant variant(single);
+    TSTRING str;
+    variant.printTo(str);
+    return conn->addMessageWithPriority(str, priorityLevel, localDeadline(ttlMs));
+  }
+
+  /** Send the latest value of something to a specific node
+   *
+   * If an earlier message with the same key is still waiting in a queue
+   * (here or on a relay), it is replaced by this one instead of sending
+   * both. This keeps queues bounded by the number of keys when a link is
+   * slow, e.g. use "temperature" as key for periodic temperature readings.
+   *
+   * @param destId The nodeId of the node to send it to.
+   * @param msg The message to send
+   * @param key Messages with the same key replace each other, if they are
+   * from the same node to the same destination. Broadcasts only replace
+   * broadcasts.
+   * @param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   *
+   * @return true if the message was queued
+   */
+  bool sendSingleCoalesced(uint32_t destId, TSTRING msg, TSTRING key,
+                           uint8_t priorityLevel = 2) {
+    Log(logger::COMMUNICATION, "sendSingleCoalesced(): dest=%u key=%s\n",
+        destId, key.c_str());
+    auto conn = painlessmesh::router::findRoute<T>((*this), destId);
+    if (!conn) return false;
+    if (priorityLevel > 0 && !acquireSendWindow(destId)) return false;
+    auto single = painlessmesh::protocol::Single(this->nodeId, destId, msg);
+    single.key = pubsub::topicHash(key);
+    protocol::Variant variant(single);
+    TSTRING str;
+    variant.printTo(str);
+    return conn->addMessageWithPriority(
+        str, priorityLevel, 0,
+        router::queueKey(this->nodeId, destId, router::SINGLE, single.key));
+  }
+
+  /** Broadcast the latest value of something, replacing queued messages
+   * with the same key. See sendSingleCoalesced().
+   *
+   * @return true if everything works, false if not
+   */
+  bool sendBroadcastCoalesced(TSTRING msg, TSTRING key,
+                              uint8_t priorityLevel = 2) {
+    Log(logger::COMMUNICATION, "sendBroadcastCoalesced(): key=%s\n",
+        key.c_str());
+    painlessmesh::protocol::Broadcast pkg(this->nodeId, 0, msg);
+    pkg.key = pubsub::topicHash(key);
+    painlessmesh::protocol::Variant variant(pkg);
+    TSTRING str;
+    variant.printTo(str);
+    auto queueKey =
+        router::queueKey(this->nodeId, 0, router::BROADCAST, pkg.key);
+    size_t success = 0;
+    for (auto &&conn : this->subs) {
+      if (conn->nodeId != 0 &&
+          conn->addMessageWithPriority(str, priorityLevel, 0, queueKey))
+        ++success;
+    }
+    return success > 0;
+  }
+
+  /** Send message to a specific node, retransmitting it until it arrives
+   *
+   * The destination acknowledges the message and delivers it to its
+   * onReceive() callback exactly once. Lost messages are retransmitted with a
+   * timeout based on the measured round trip time, up to RELIABLE_MAX_RETRIES
+   * times. Use onReliableDelivery() to find out whether a message arrived.
+   *
+   * The destination needs to run a version of painlessMesh that supports
+   * reliable messages, older nodes never acknowledge them.
+   *
+   * @param destId The nodeId of the node to send it to.
+   * @param msg The message to send
+   *
+   * @return The sequence number of the message, or 0 if RELIABLE_MAX_PENDING
+   * messages to this node, or messages to RELIABLE_MAX_PEERS other nodes, are
+   * still waiting for an acknowledgement.
+   */
+  uint32_t sendSingleReliable(uint32_t destId, TSTRING msg) {
+    Log(logger::COMMUNICATION, "sendSingleReliable(): dest=%u msg=%s\n",
+        destId, msg.c_str());
+    if (!acquireSendWindow(destId)) return 0;
+    auto pkg = reliableSender.send(this->nodeId, destId, msg, millis());
+    if (pkg.seq == 0) {
+      Log(logger::COMMUNICATION,
+          "sendSingleReliable(): too many pending messages to %u\n", destId);
+      return 0;
+    }
+    // A failed send is handled like a lost message
+    this->sendPackage(&pkg);
+    if (reliableTask == nullptr) {
+      reliableTask = this->addTask(RELIABLE_TICK, TASK_FOREVER,
+                                   [this]() { this->processReliable(); });
+    }
+    return pkg.seq;
+  }
+
+  /** Callback that gets called when a reliable message was acknowledged, or
+   * when we gave up on it.
+   *
+   * \code
+   * mesh.onReliableDelivery([](uint32_t destId, uint32_t seq, bool delivered) {
+   *   if (!delivered) Serial.printf("Message %u to %u lost\n", seq, destId);
+   * });
+   * \endcode
+   */
+  void onReliableDelivery(reliableDeliveryCallback_t onDelivery) {
+    reliableDeliveryCallback = onDelivery;
+  }
+
+  /**
+   * Statistics of reliable delivery
+   *
+   * Compare retransmissions to sent messages to see how lossy the routes are.
+   */
+  reliable::ReliableStats getReliableStats() {
+    auto stats = reliableSender.stats;
+    stats.received = reliableReceiver.stats.received;
+    stats.duplicates = reliableReceiver.stats.duplicates;
+    stats.acksSent = reliableReceiver.stats.acksSent;
+    stats.skipped = reliableReceiver.stats.skipped;
+    return stats;
+  }
+
+  /**
+   * Make a method callable by other nodes
+   *
+   * \code
+   * mesh.registerMethod("relay", [](uint32_t from, const TSTRING &params,
+   *                                 TSTRING &result) {
+   *   digitalWrite(RELAY_PIN, params == "on" ? HIGH : LOW);
+   *   result = params;
+   *   return (int)rpc::OK;
+   * });
+   * \endcode
+   *
+   * @param name Name of the method, replaces a method with the same name
+   * @param handler Sets the result and returns an rpc::Status
+   */
+  void registerMethod(TSTRING name, rpc::methodHandler_t handler) {
+    rpcMethods[name] = handler;
+  }
+
+  void unregisterMethod(TSTRING name) { rpcMethods.erase(name); }
+
+  /**
+   * Call a method on another node
+   *
+   * The callback gets the status and result of the method, rpc::TIMEOUT if
+   * there is no result within timeoutMs, or rpc::NOT_SENT if the call was
+   * refused. Many calls, also to the same
+   * node, can be outstanding at the same time.
+   *
+   * \code
+   * mesh.call(nodeId, "relay", "on", [](int status, const TSTRING &result) {
+   *   if (status != rpc::OK) Serial.printf("Call failed: %d\n", status);
+   * });
+   * \endcode
+   *
+   * @param destId The node to call the method on
+   * @param method Name of the method
+   * @param params Parameters, e.g. JSON, passed to the method as is
+   * @param callback Called exactly once with the result
+   * @param timeoutMs Time to wait for the result
+   *
+   * @return The id of the call, or 0 if RPC_MAX_PENDING calls to this node are
+   * still outstanding or the call could not be send. The callback is then
+   * called with rpc::NOT_SENT from a task, not from within call().
+   */
+  uint32_t call(uint32_t destId, TSTRING method, TSTRING params,
+                rpc::resultCallback_t callback,
+                uint32_t timeoutMs = RPC_DEFAULT_TIMEOUT) {
+    auto id = rpcCalls.add(destId, callback, millis() + timeoutMs);
+    if (id == 0) {
+      Log(logger::COMMUNICATION, "call(): too many pending calls to %u\n",
+          destId);
+      callNotSent(callback, "Too many pending calls");
+      return 0;
+    }
+    rpc::RequestPackage pkg;
+    pkg.from = this->nodeId;
+    pkg.dest = destId;
+    pkg.id = id;
+    pkg.method = method;
+    pkg.params = params;
+    if (!this->sendPackage(&pkg)) {
+      rpcCalls.cancel(id);
+      callNotSent(callback, "Could not send call");
+      return 0;
+    }
+    if (rpcTask == nullptr) {
+      rpcTask = this->addTask(RPC_TICK, TASK_FOREVER,
+                              [this]() { this->processRpc(); });
+    }
+    return id;
+  }
+
+  /**
+   * Statistics of calls made and served
+   */
+  rpc::RpcStats getRpcStats() { return rpcCalls.stats; }
+
+  /**
+   * Current retransmission timeout towards a node in milliseconds
+   */
+  uint32_t getReliableTimeout(uint32_t destId) {
+    return reliableSender.rto(destId);
+  }
+
+  /**
+   * Number of single messages we may currently send to a node per
+   * FLOW_CONTROL_INTERVAL
+   *
+   * Relays on the route to a node ask us to slow down when their queue
+   * towards it fills up. sendSingle() returns false while the window is used
+   * up. Returns FLOW_CONTROL_MAX_WINDOW if the route is not limited.
+   */
+  uint16_t getSendWindow(uint32_t destId) { return flowWindow.window(destId); }
+
+  /**
+   * Statistics about keeping the subtree attached while looking for a new
+   * parent (see handover.hpp)
+   */
+  handover::HandoverStats getHandoverStats() { return this->handover.stats; }
+
+  /**
+   * Flow control statistics
+   */
+  flowcontrol::FlowControlStats getFlowControlStats() {
+    auto stats = flowWindow.stats;
+    stats.limited = flowWindow.size();
+    return stats;
+  }
+
+  /**
+   * Limit the send queue of every connection
+   *
+   * By default each connection queues at most MAX_MESSAGE_QUEUE messages and
+   * MAX_MESSAGE_QUEUE_BYTES bytes. When a new message does not fit, the
+   * policy decides what happens:
+   * - buffer::DROP_LOWEST_PRIORITY drops the oldest of the least important
+   *   queued messages
+   * - buffer::DROP_OLDEST drops the oldest queued message
+   * - buffer::REJECT_NEW refuses the new message
+   *
+   * Queued messages that are more important than the new message are never
+   * dropped. Use 0 for no limit.
+   */
+  void setQueueLimits(size_t maxMessages, size_t maxBytes,
+                      buffer::DropPolicy policy = buffer::DROP_LOWEST_PRIORITY) {
+    queueMaxMessages = maxMessages;
+    queueMaxBytes = maxBytes;
+    queueDropPolicy = policy;
+    for (auto &&conn : this->subs)
+      conn->setQueueLimits(maxMessages, maxBytes, policy);
+  }
+
+  /**
+   * Callback that gets called when the send queue to a neighbour fills beyond
+   * QUEUE_HIGH_WATERMARK percent of its limits (high is true), and when it
+   * drained below QUEUE_LOW_WATERMARK percent again (high is false).
+   *
+   * \code
+   * mesh.onQueueWatermark([](uint32_t nodeId, bool high) {
+   *   sensorsPaused = high;
+   * });
+   * \endcode
+   */
+  void onQueueWatermark(queueWatermarkCallback_t onWatermark) {
+    queueWatermarkCallback = onWatermark;
+  }
+
+  /**
+   * Send queue statistics of the connection to a direct neighbour
+   *
+   * Includes the queued and peak bytes and the number of dropped messages.
+   * All zero if we are not connected to the node.
+   */
+  buffer::SentBuffer<TSTRING>::SendStats getQueueStats(uint32_t nodeId) {
+    for (auto &&conn : this->subs) {
+      if (conn->nodeId == nodeId) return conn->getQueueStats();
+    }
+    return buffer::SentBuffer<TSTRING>().getStats();
+  }
+
   /** Broadcast a message to every node on the mesh network.
    *
    * @param includeSelf Send message to myself as well. Default is false.
@@ -420,7 +864,138 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     if (success > 0) return true;
     return false;
   }
+
+  /** Broadcast a message that is dropped if it is still queued when its
+   * deadline passes, see sendSingleWithDeadline().
+   *
+   * @param msg The message to broadcast
+   * @param ttlMs Time the message stays useful in milliseconds
+   * @param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   * @param includeSelf Send message to myself as well. Default is false.
+   *
+   * @return true if everything works, false if not
+   */
+  bool sendBroadcastWithDeadline(TSTRING msg, uint32_t ttlMs,
+                                 uint8_t priorityLevel = 2,
+                                 bool includeSelf = false) {
+    using namespace logger;
+    Log(COMMUNICATION, "sendBroadcastWithDeadline(): msg=%s ttl=%u\n",
+        msg.c_str(), ttlMs);
+    painlessmesh::protocol::Broadcast pkg(this->nodeId, 0, msg);
+    pkg.deadline = this->getNodeTime() + ttlMs * 1000;
+    if (pkg.deadline == 0) pkg.deadline = 1;
+    painlessmesh::protocol::Variant variant(pkg);
+    TSTRING msgStr;
+    variant.printTo(msgStr);
+    auto deadline = localDeadline(ttlMs);
+    size_t success = 0;
+    for (auto &&conn : this->subs) {
+      if (conn->nodeId != 0 &&
+          conn->addMessageWithPriority(msgStr, priorityLevel, deadline))
+        ++success;
+    }
+    if (includeSelf) {
+      protocol::Variant var(pkg);
+      this->callbackList.execute(var.type(), var, NULL, 0);
+    }
+    return success > 0;
+  }
+
+  /**
+   * Messages dropped because their deadline passed
+   *
+   * Counts the messages that expired in our send queues (per priority) and
+   * those that had already expired when they reached us.
+   */
+  buffer::ExpiryStats getExpiryStats() {
+    buffer::ExpiryStats stats;
+    for (auto &&conn : this->subs) {
+      auto queue = conn->getQueueStats();
+      stats.critical += queue.criticalExpired;
+      stats.high += queue.highExpired;
+      stats.normal += queue.normalExpired;
+      stats.low += queue.lowExpired;
+      stats.onArrival += conn->expiredMessages;
+    }
+    return stats;
+  }
   
+  /**
+   * Change the limits received messages are checked against before they are
+   * parsed
+   *
+   * Messages that are too large, nest too deep, contain too long strings or
+   * come from an invalid node id are dropped without parsing them. The
+   * defaults (validation::routerConfig()) allow for OTA data and deep trees.
+   */
+  void setValidationConfig(const validation::ValidationConfig &config) {
+    this->validationConfig = config;
+  }
+
+  /**
+   * Messages dropped on arrival, per reason, over all current connections
+   */
+  validation::RejectionStats getRejectionStats() {
+    validation::RejectionStats stats;
+    for (auto &&conn : this->subs) stats.add(conn->rejectedMessages);
+    return stats;
+  }
+
+  /**
+   * Limit the messages this node handles and forwards from each origin
+   *
+   * Messages from an origin over its limit are dropped, so a single node
+   * flooding the mesh can't saturate every link. Limits are token buckets:
+   * an origin can send burst messages at once and ratePerSecond after that.
+   *
+   * \code
+   * // At most 5 application messages per second from each node
+   * mesh.setRateLimit(ratelimit::ANY_TYPE, 5, 10);
+   * // But only one sensor reading per second
+   * mesh.setRateLimit(200, 1, 2);
+   * \endcode
+   *
+   * @param type Package type, or ratelimit::ANY_TYPE for all types without a
+   * limit of their own (time and node sync are never limited by it)
+   * @param ratePerSecond Messages per second, 0 removes the limit
+   * @param burst Messages an origin can send at once
+   * @return false if there are already RATE_LIMIT_RULES limits
+   */
+  bool setRateLimit(int type, uint16_t ratePerSecond, uint16_t burst) {
+    if (!this->rateLimiter)
+      this->rateLimiter = std::make_shared<ratelimit::RateLimiter>();
+    return this->rateLimiter->setLimit(type, ratePerSecond, burst);
+  }
+
+  /**
+   * Rate limit statistics, see setRateLimit()
+   *
+   * Dropped messages are also counted per connection, see getRejectionStats()
+   */
+  ratelimit::RateLimitStats getRateLimitStats() {
+    if (!this->rateLimiter) return ratelimit::RateLimitStats();
+    return this->rateLimiter->stats;
+  }
+
+  /**
+   * Limit the hops packages of a type travel through the mesh
+   *
+   * Bounds how often a package can be forwarded while the layout is briefly
+   * inconsistent. Use the same limits on all nodes.
+   *
+   * @param type Package type
+   * @param hops Maximum hops, 0 restores the default (HOP_LIMIT_DEFAULT)
+   */
+  void setHopLimit(int type, uint8_t hops) {
+    this->hopLimits.setLimit(type, hops);
+  }
+
+  /**
+   * Hops travelled by the routed packages we received, and how many of them
+   * were not forwarded because their hop limit was reached
+   */
+  hoplimit::HopStats getHopStats() { return this->hopLimits.stats; }
+
   /** Broadcast a message with priority to every node on the mesh network.
    *
    * @param msg The message to broadcast
@@ -912,6 +1487,11 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
 
   /**
    * Set the interval for bridge status broadcasts (bridge nodes only)
+   *
+   * Changes are broadcast right away. While nothing changes, compact
+   * keepalives are send with an interval growing from this interval up to
+   * BRIDGE_KEEPALIVE_MAX_INTERVAL. Every keepalive tells the receivers when
+   * to expect the next one, so they don't time the bridge out meanwhile.
    * 
    * @param intervalMs Broadcast interval in milliseconds (default: 30000 = 30 seconds)
    */
@@ -926,6 +1506,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
    */
   void setBridgeTimeout(uint32_t timeoutMs) {
     bridgeTimeoutMs = timeoutMs;
+    this->gatewayDirectory.setTimeout(timeoutMs);
   }
 
   /**
@@ -937,6 +1518,19 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     bridgeStatusBroadcastEnabled = enabled;
   }
 
+  /**
+   * Stay compatible with nodes that don't know bridge keepalives (bridge
+   * nodes only)
+   *
+   * Older nodes ignore keepalives and time a bridge out after their bridge
+   * time out. In a mesh with such nodes enable this, so the bridge sends its
+   * full status every setBridgeStatusInterval() and coordination messages at
+   * least every half bridge time out, as before.
+   *
+   * @param enabled true to send full status instead of keepalives
+   */
+  void setBridgeStatusCompat(bool enabled) { bridgeStatusCompat = enabled; }
+
   /**
    * Clean up expired bridge entries that haven't reported recently
    * 
@@ -1298,17 +1892,23 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       return 0;
     }
 
-    // Find the best gateway to route through
-    BridgeInfo* gateway = getPrimaryBridge();
-    if (gateway == nullptr) {
-      Log(ERROR, "sendToInternet(): No gateway available\n");
-      if (callback) {
-        // Schedule callback to avoid blocking
-        this->addTask([callback]() {
-          callback(false, 0, "No gateway available");
-        });
+    // Find the best gateway to route through, unless all gateways already
+    // have their limit of striped requests in flight
+    uint32_t gatewayId = 0;
+    std::shared_ptr<T> conn;
+    bool deferred = uplinkStriping && stripeBusy();
+    if (!deferred) {
+      conn = internetRoute(gatewayId);
+      if (gatewayId == 0) {
+        Log(ERROR, "sendToInternet(): No gateway available\n");
+        if (callback) {
+          // Schedule callback to avoid blocking
+          this->addTask([callback]() {
+            callback(false, 0, "No gateway available");
+          });
+        }
+        return 0;
       }
-      return 0;
     }
 
     // Create and store the pending request
@@ -1320,18 +1920,31 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     request.priority = priority;
     request.timeoutMs = internetRequestTimeout;
     request.retryDelayMs = internetRetryDelay;
-    request.gatewayNodeId = gateway->nodeId;
+    request.gatewayNodeId = gatewayId;
     request.destination = destination;
     request.payload = payload;
     request.callback = callback;
+    if (uplinkStriping) {
+      if (++stripeSequence == 0) ++stripeSequence;
+      request.sequence = stripeSequence;
+    }
 
     // Store pending request
     pendingInternetRequests[messageId] = request;
 
+    if (deferred) {
+      Log(COMMUNICATION, "sendToInternet(): All gateways busy, msgId=%u waits\n",
+          messageId);
+      stripeBacklog.push_back(messageId);
+      ++stripeScheduler.stats.deferred;
+      scheduleInternetTimeout(messageId);
+      return messageId;
+    }
+
     // Create gateway data package
     gateway::GatewayDataPackage pkg;
     pkg.from = this->nodeId;
-    pkg.dest = gateway->nodeId;
+    pkg.dest = anycastInternet() ? protocol::ANY_GATEWAY : gatewayId;
     pkg.messageId = messageId;
     pkg.originNode = this->nodeId;
     pkg.timestamp = this->getNodeTime();
@@ -1341,25 +1954,25 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     pkg.contentType = "application/json";
     pkg.retryCount = 0;
     pkg.requiresAck = true;
+    pkg.sequence = request.sequence;
 
     // Send the package with priority
     bool sent = false;
-    auto conn = painlessmesh::router::findRoute<T>((*this), gateway->nodeId);
     if (conn) {
       sent = painlessmesh::router::sendWithPriority(pkg, conn, priority);
       if (!sent) {
-        Log(ERROR, "sendToInternet(): sendWithPriority failed to gateway %u (send buffer full?)\n", gateway->nodeId);
+        Log(ERROR, "sendToInternet(): sendWithPriority failed to gateway %u (send buffer full?)\n", gatewayId);
       }
     } else {
-      Log(ERROR, "sendToInternet(): No route to gateway %u\n", gateway->nodeId);
+      Log(ERROR, "sendToInternet(): No route to gateway %u\n", gatewayId);
     }
 
     if (!sent) {
-      Log(ERROR, "sendToInternet(): Failed to send to gateway %u, scheduling retry\n", gateway->nodeId);
+      Log(ERROR, "sendToInternet(): Failed to send to gateway %u, scheduling retry\n", gatewayId);
       // Schedule retry or failure callback
       scheduleInternetRetry(messageId);
     } else {
-      Log(COMMUNICATION, "sendToInternet(): Sent to gateway %u\n", gateway->nodeId);
+      Log(COMMUNICATION, "sendToInternet(): Sent to gateway %u\n", gatewayId);
       // Schedule timeout check
       scheduleInternetTimeout(messageId);
     }
@@ -1394,6 +2007,68 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     internetRetryDelay = delayMs;
   }
 
+  /**
+   * Send Internet requests to the nearest healthy gateway
+   *
+   * By default sendToInternet() sends every request to the primary bridge.
+   * With anycast enabled requests are addressed to protocol::ANY_GATEWAY and
+   * each hop forwards them towards the nearest gateway with Internet that it
+   * knows of, so the load spreads over the gateways and requests fail over
+   * as soon as a gateway stops reporting Internet. All nodes on the way need
+   * to support anycast, so only enable it once the whole mesh is updated.
+   *
+   * @param enable Whether to use anycast (default: true)
+   */
+  void enableGatewayAnycast(bool enable = true) { gatewayAnycast = enable; }
+
+  /**
+   * Anycast routing statistics
+   *
+   * @return Messages forwarded/delivered by this node and the number of
+   * healthy gateways it currently knows of
+   */
+  anycast::AnycastStats getAnycastStats() {
+    auto stats = this->gatewayDirectory.stats;
+    stats.gateways = this->gatewayDirectory.gateways(millis()).size();
+    return stats;
+  }
+
+  /**
+   * Stripe Internet requests over all healthy gateways
+   *
+   * Useful for bulk uploads: instead of sending every request to the primary
+   * bridge, each request goes to the next gateway with Internet in a
+   * weighted round robin (see striping.hpp). Gateways are weighted by the
+   * capacity they advertise, or by their router signal. At most maxInFlight
+   * requests per gateway wait for their acknowledgement, further requests
+   * are held until one finishes. Requests carry a sequence number, because
+   * they can reach the destination out of order.
+   *
+   * Takes precedence over enableGatewayAnycast().
+   *
+   * @param enable Whether to stripe requests (default: true)
+   * @param maxInFlight Unacknowledged requests per gateway
+   */
+  void enableUplinkStriping(bool enable = true,
+                            uint8_t maxInFlight = STRIPE_MAX_IN_FLIGHT) {
+    uplinkStriping = enable;
+    stripeScheduler.inFlightLimit = maxInFlight > 0 ? maxInFlight : 1;
+    if (!enable) drainStripeBacklog();
+  }
+
+  /**
+   * Uplink striping statistics
+   *
+   * @return Requests striped and deferred, the gateways they are striped over
+   * and the requests currently waiting for a gateway
+   */
+  striping::StripeStats getStripeStats() {
+    auto stats = stripeScheduler.stats;
+    stats.bridges = stripeCandidates().size();
+    stats.backlog = stripeBacklog.size();
+    return stats;
+  }
+
   /**
    * Get number of pending Internet requests
    *
@@ -1448,6 +2123,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
         [this](protocol::Variant& variant, std::shared_ptr<T>, uint32_t) {
           auto ack = variant.to<gateway::GatewayAckPackage>();
           this->handleGatewayAck(ack);
+          this->drainStripeBacklog();
           return false;  // Don't consume, allow other handlers
         });
 
@@ -1603,6 +2279,79 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     }
   }
 
+  /**
+   * Connection to send an Internet request over
+   *
+   * With striping enabled this leads to the next gateway with room for
+   * another request, with anycast to the nearest healthy gateway, otherwise
+   * to the primary bridge.
+   *
+   * @param gatewayId Set to the chosen gateway, 0 if there is none
+   * @return The connection, nullptr if the gateway can't be reached
+   */
+  std::shared_ptr<T> internetRoute(uint32_t& gatewayId) {
+    gatewayId = 0;
+    if (uplinkStriping) {
+      gatewayId = stripeScheduler.pick(stripeCandidates());
+      if (gatewayId == 0) return nullptr;
+      return painlessmesh::router::findRoute<T>((*this), gatewayId);
+    }
+    if (gatewayAnycast) {
+      return painlessmesh::router::nearestGateway<T>(
+          (*this), this->gatewayDirectory.gateways(millis()), nullptr,
+          gatewayId);
+    }
+    BridgeInfo* gateway = getPrimaryBridge();
+    if (gateway == nullptr) return nullptr;
+    gatewayId = gateway->nodeId;
+    return painlessmesh::router::findRoute<T>((*this), gatewayId);
+  }
+
+  /**
+   * Whether Internet requests are addressed to protocol::ANY_GATEWAY
+   *
+   * Striped requests are always addressed to the gateway they were assigned.
+   */
+  bool anycastInternet() const { return gatewayAnycast && !uplinkStriping; }
+
+  /**
+   * Reachable gateways with Internet and their requests in flight
+   */
+  std::vector<striping::StripeCandidate> stripeCandidates() {
+    std::vector<striping::StripeCandidate> candidates;
+    for (auto&& bridge : knownBridges) {
+      if (!bridge.internetConnected || !bridge.isHealthy(bridgeTimeoutMs))
+        continue;
+      if (!painlessmesh::router::findRoute<T>((*this), bridge.nodeId)) continue;
+      striping::StripeCandidate candidate;
+      candidate.nodeId = bridge.nodeId;
+      candidate.weight =
+          striping::capacityWeight(bridge.capacity, bridge.routerRSSI);
+      for (auto&& pending : pendingInternetRequests) {
+        if (pending.second.gatewayNodeId == bridge.nodeId) ++candidate.inFlight;
+      }
+      candidates.push_back(candidate);
+    }
+    return candidates;
+  }
+
+  /**
+   * Whether there are gateways, but all have their limit of requests in flight
+   */
+  bool stripeBusy() { return stripeScheduler.busy(stripeCandidates()); }
+
+  /**
+   * Send requests that waited for a gateway, as long as one has room
+   */
+  void drainStripeBacklog() {
+    while (!stripeBacklog.empty() && (!uplinkStriping || !stripeBusy())) {
+      auto messageId = stripeBacklog.front();
+      stripeBacklog.pop_front();
+      if (pendingInternetRequests.count(messageId) > 0)
+        retryInternetRequest(messageId);
+    }
+  }
+
   /**
    * Schedule retry for a failed Internet request
    */
@@ -1658,9 +2407,20 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       return;
     }
 
+    // Wait for a striped request in flight to finish, instead of using up a
+    // retry. This request itself no longer counts as in flight.
+    if (uplinkStriping) {
+      request.gatewayNodeId = 0;
+      if (stripeBusy()) {
+        stripeBacklog.push_back(messageId);
+        return;
+      }
+    }
+
     // Find gateway (may have changed)
-    BridgeInfo* gateway = getPrimaryBridge();
-    if (gateway == nullptr) {
+    uint32_t gatewayId = 0;
+    auto conn = internetRoute(gatewayId);
+    if (gatewayId == 0) {
       Log(logger::ERROR, "retryInternetRequest(): No gateway for retry msgId=%u\n",
           messageId);
       scheduleInternetRetry(messageId);
@@ -1668,12 +2428,12 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     }
 
     // Update gateway node ID (may have changed)
-    request.gatewayNodeId = gateway->nodeId;
+    request.gatewayNodeId = gatewayId;
 
     // Create gateway data package
     gateway::GatewayDataPackage pkg;
     pkg.from = this->nodeId;
-    pkg.dest = gateway->nodeId;
+    pkg.dest = anycastInternet() ? protocol::ANY_GATEWAY : gatewayId;
     pkg.messageId = messageId;
     pkg.originNode = this->nodeId;
     pkg.timestamp = this->getNodeTime();
@@ -1683,9 +2443,9 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     pkg.contentType = "application/json";
     pkg.retryCount = request.retryCount;
     pkg.requiresAck = true;
+    pkg.sequence = request.sequence;
 
     // Send the package
-    auto conn = painlessmesh::router::findRoute<T>((*this), gateway->nodeId);
     bool sent = false;
     if (conn) {
       sent = painlessmesh::router::sendWithPriority(pkg, conn, request.priority);
@@ -1696,7 +2456,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       scheduleInternetRetry(messageId);
     } else {
       Log(logger::COMMUNICATION, "retryInternetRequest(): Retry sent msgId=%u to gateway %u\n",
-          messageId, gateway->nodeId);
+          messageId, gatewayId);
     }
   }
 
@@ -1734,6 +2494,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
         request.callback(false, 0, "Request timed out");
       }
       pendingInternetRequests.erase(it);
+      drainStripeBacklog();
     }
   }
 
@@ -1741,6 +2502,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
    * Cleanup all timed-out Internet requests
    */
   void cleanupTimedOutRequests() {
+    bool removed = false;
     auto it = pendingInternetRequests.begin();
     while (it != pendingInternetRequests.end()) {
       if (it->second.isTimedOut()) {
@@ -1750,13 +2512,35 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
           it->second.callback(false, 0, "Request timed out");
         }
         it = pendingInternetRequests.erase(it);
+        removed = true;
       } else {
         ++it;
       }
     }
+    // The timed out requests no longer count as in flight
+    if (removed) drainStripeBacklog();
   }
 
  public:
+  /**
+   * Mark a known bridge as seen, without changing its status
+   *
+   * @param nextMs Time until the next keepalive of the bridge at most, 0 if
+   * unknown. The bridge is kept for at least twice this time.
+   * @return false if the bridge is not known (yet)
+   */
+  bool refreshBridge(uint32_t bridgeNodeId, uint32_t nextMs = 0) {
+    for (auto&& bridge : knownBridges) {
+      if (bridge.nodeId != bridgeNodeId) continue;
+      bridge.lastSeen = millis();
+      bridge.nextMs = nextMs;
+      this->gatewayDirectory.refresh(bridgeNodeId, bridge.lastSeen,
+                                      2 * nextMs);
+      return true;
+    }
+    return false;
+  }
+
   /**
    * Update bridge information from received status package
    * Internal method called when bridge status is received
@@ -1768,10 +2552,12 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
    * @param uptime Bridge uptime
    * @param gatewayIP Router gateway IP
    * @param timestamp Status timestamp
+   * @param capacity Advertised uplink capacity, 0 if unknown
    */
   void updateBridgeStatus(uint32_t bridgeNodeId, bool internetConnected, 
                          int8_t routerRSSI, uint8_t routerChannel,
-                         uint32_t uptime, TSTRING gatewayIP, uint32_t timestamp) {
+                         uint32_t uptime, TSTRING gatewayIP, uint32_t timestamp,
+                         uint8_t capacity = 0) {
     // Find existing bridge or add new one
     BridgeInfo* bridge = nullptr;
     uint32_t oldPrimaryBridgeId = 0;
@@ -1828,9 +2614,13 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     bridge->routerRSSI = routerRSSI;
     bridge->routerChannel = routerChannel;
     bridge->lastSeen = millis();
+    bridge->nextMs = 0;
     bridge->uptime = uptime;
+    this->gatewayDirectory.seen(bridgeNodeId, internetConnected,
+                                 bridge->lastSeen);
     bridge->gatewayIP = gatewayIP;
     bridge->timestamp = timestamp;
+    bridge->capacity = capacity;
     
     // Check if primary bridge changed
     auto newPrimary = this->getPrimaryBridge();
@@ -1965,7 +2755,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       }
     }
     // Fallback to mesh time (microseconds), converted to seconds for consistency
-    return getNodeTime() / 1000000;
+    return (uint32_t)(getNodeTime64() / 1000000);
   }
 
   /**
@@ -2055,6 +2845,276 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     return this->hasTimeAuthority;
   }
 
+  //
+  // Transmission slot API
+  //
+
+  /**
+   * Set the number of transmission slots each period is divided in
+   *
+   * Nodes use their own slot within each period, see addSlottedTask(). Unless
+   * the root assigned one, the slot is derived from the node id. All nodes
+   * should use the same number of slots.
+   *
+   * @param slotCount Number of slots per period (default TRANSMIT_SLOT_COUNT)
+   */
+  void setTransmitSlots(uint16_t slotCount) {
+    if (slotCount == 0) return;
+    transmitSlotCount = slotCount;
+    transmitSlotAssigned = false;
+    if (slotAssignmentEnabled && this->isRoot()) assignTransmitSlots();
+  }
+
+  /**
+   * Slot this node transmits its periodic traffic in
+   */
+  uint16_t getTransmitSlot() {
+    if (transmitSlotAssigned) return transmitSlot;
+    return slots::defaultSlot(this->nodeId, transmitSlotCount);
+  }
+
+  /**
+   * Time until the start of our next slot (ms)
+   *
+   * @param periodMs Length of the period that is divided in slots
+   */
+  uint32_t timeToNextSlot(uint32_t periodMs) {
+    return slots::timeToNextSlot(this->getNodeTime64(), periodMs,
+                                 getTransmitSlot(), transmitSlotCount);
+  }
+
+  /**
+   * Add a periodic task that runs at the start of our transmission slot
+   *
+   * The task is realigned with the mesh time after every iteration, so
+   * nodes running a task with the same period transmit in turn instead of
+   * all at once. The slot length is periodMs divided by the number of slots,
+   * so choose the period such that a slot is long enough for what you send.
+   *
+   * \code
+   * // Send sensor readings every 10 seconds, in our own slot
+   * mesh.addSlottedTask(10000, TASK_FOREVER, []() {
+   *   mesh.sendSingle(rootId, readSensors());
+   * });
+   * \endcode
+   *
+   * @param periodMs Period of the task
+   * @param iterations Number of iterations (TASK_FOREVER for no limit)
+   * @param callback Function to call in our slot
+   */
+  std::shared_ptr<Task> addSlottedTask(uint32_t periodMs, long iterations,
+                                       std::function<void()> callback) {
+    auto task = this->addTask(periodMs, iterations, []() {});
+    std::weak_ptr<Task> weakTask = task;
+    task->setCallback([this, weakTask, periodMs, callback]() {
+      callback();
+      auto task = weakTask.lock();
+      if (!task) return;
+      auto wait = this->timeToNextSlot(periodMs);
+      task->delay(wait == 0 ? periodMs : wait);
+    });
+    task->delay(timeToNextSlot(periodMs));
+    return task;
+  }
+
+  /**
+   * Run the callback once, at the start of our next transmission slot
+   *
+   * @param periodMs Length of the period that is divided in slots
+   * @param callback Function to call in our slot
+   */
+  std::shared_ptr<Task> scheduleInSlot(uint32_t periodMs,
+                                       std::function<void()> callback) {
+    return this->addTask(callback, timeToNextSlot(periodMs));
+  }
+
+  /**
+   * Let the root node assign transmission slots to all nodes
+   *
+   * Only has an effect on the root node (see setRoot()). The root hands out
+   * the least used slot to every node that joins, so nodes only share a slot
+   * if there are more nodes than slots. Assignments are repeated every
+   * TRANSMIT_SLOT_REFRESH, in case one got lost on the way.
+   */
+  void enableSlotAssignment(bool enabled = true) {
+    slotAssignmentEnabled = enabled;
+    if (!enabled) {
+      slotAssigner.clear();
+      if (slotRefreshTask) {
+        slotRefreshTask->disable();
+        slotRefreshTask = nullptr;
+      }
+      return;
+    }
+    if (slotRefreshTask == nullptr) {
+      slotRefreshTask =
+          this->addTask(TRANSMIT_SLOT_REFRESH, TASK_FOREVER, [this]() {
+            if (this->isRoot()) this->assignTransmitSlots(true);
+          });
+    }
+    if (this->isRoot()) assignTransmitSlots();
+  }
+
+  //
+  // Publish/subscribe API
+  //
+
+  /**
+   * Subscribe to messages published on a topic
+   *
+   * The subscription is advertised to the rest of the mesh, so that messages
+   * on the topic are routed towards this node. Multiple callbacks can be
+   * registered for the same topic.
+   *
+   * \code
+   * mesh.subscribe("sensors/temperature", [](uint32_t from, TSTRING &topic,
+   *                                          TSTRING &msg) {
+   *   Serial.printf("%u: %s\n", from, msg.c_str());
+   * });
+   * \endcode
+   */
+  void subscribe(TSTRING topic, topicReceivedCallback_t callback) {
+    Log(logger::GENERAL, "subscribe(): %s\n", topic.c_str());
+    topicCallbacks.push_back(std::make_pair(topic, callback));
+    updateSubscribedTopics();
+  }
+
+  /**
+   * Remove all subscriptions to a topic
+   */
+  void unsubscribe(TSTRING topic) {
+    Log(logger::GENERAL, "unsubscribe(): %s\n", topic.c_str());
+    topicCallbacks.remove_if(
+        [&topic](const std::pair<TSTRING, topicReceivedCallback_t> &sub) {
+          return sub.first == topic;
+        });
+    updateSubscribedTopics();
+  }
+
+  /**
+   * Publish a message on a topic
+   *
+   * The message is only send towards nodes that subscribed to the topic.
+   *
+   * @param topic The topic to publish on
+   * @param msg The message
+   * @param includeSelf Deliver to our own subscribers as well
+   *
+   * @return true if the message was send to at least one neighbour
+   */
+  bool publish(TSTRING topic, TSTRING msg, bool includeSelf = false) {
+    Log(logger::COMMUNICATION, "publish(): topic=%s msg=%s\n", topic.c_str(),
+        msg.c_str());
+    pubsub::PublishPackage pkg;
+    pkg.from = this->nodeId;
+    pkg.topic = pubsub::topicHash(topic);
+    pkg.name = topic;
+    pkg.msg = msg;
+    protocol::Variant variant(&pkg);
+    auto sent = router::broadcastTopic<T>(variant, (*this), 0);
+    ++topicsPublished;
+    if (includeSelf) deliverTopic(variant);
+    return sent > 0;
+  }
+
+  /**
+   * Publish/subscribe statistics
+   *
+   * The number of suppressed transmissions shows how much traffic was saved
+   * compared to flooding the messages to every node.
+   */
+  pubsub::PubSubStats getPubSubStats() {
+    pubsub::PubSubStats stats;
+    stats.published = topicsPublished;
+    stats.delivered = topicsDelivered;
+    stats.topics = subscribedTopics.size();
+    for (auto &&conn : this->subs) stats.suppressed += conn->suppressedTopicMessages;
+    return stats;
+  }
+
+  //
+  // In-network aggregation API
+  //
+
+  /**
+   * Reduce sensor readings on their way to a sink
+   *
+   * All nodes taking part, the sink included, enable aggregation with the
+   * same sink and register the same reducers with addReducer(). Readings
+   * added with contribute() are merged per key and window on every node on
+   * the way, so the sink receives one aggregate per key and window from each
+   * of its branches instead of every reading (see aggregate.hpp).
+   *
+   * \code
+   * mesh.enableAggregation(sinkId);
+   * mesh.addReducer(ZONE_1_TEMPERATURE, aggregate::MEAN | aggregate::MAX,
+   *                 10 * TASK_SECOND);
+   * mesh.contribute(ZONE_1_TEMPERATURE, readTemperature());
+   * // On the sink
+   * mesh.onAggregate([](const aggregate::Partial &aggregate) {
+   *   Serial.printf("%u: mean %f of %u\n", aggregate.key, aggregate.mean(),
+   *                 aggregate.count);
+   * });
+   * \endcode
+   *
+   * @param sinkId The node that consumes the aggregates
+   */
+  void enableAggregation(uint32_t sinkId) {
+    if (this->aggregator)
+      this->aggregator->setSink(sinkId);
+    else
+      this->aggregator = std::make_shared<aggregate::Aggregator>(sinkId);
+    if (aggregateTask == nullptr) {
+      aggregateTask = this->addTask(AGGREGATE_CHECK_INTERVAL, TASK_FOREVER,
+                                    [this]() { this->flushAggregates(); });
+    }
+  }
+
+  /**
+   * Reduce the readings of a key
+   *
+   * @param key Application defined, e.g. sensor type or zone
+   * @param reducers Combination of aggregate::Reducer values
+   * @param windowMs Time over which readings are reduced
+   */
+  void addReducer(uint32_t key, uint8_t reducers = aggregate::ALL,
+                  uint32_t windowMs = 10 * TASK_SECOND) {
+    if (!this->aggregator) enableAggregation(0);
+    this->aggregator->addReducer(key, reducers, windowMs, millis());
+  }
+
+  /**
+   * Stop reducing the readings of a key
+   */
+  void removeReducer(uint32_t key) {
+    if (this->aggregator) this->aggregator->removeReducer(key);
+  }
+
+  /**
+   * Add a reading of this node
+   *
+   * @return false if there is no reducer for the key
+   */
+  bool contribute(uint32_t key, double value) {
+    if (!this->aggregator) return false;
+    return this->aggregator->contribute(key, value, this->getNodeTime());
+  }
+
+  /**
+   * Callback for the aggregates at the end of each window, on the sink
+   */
+  void onAggregate(aggregateCallback_t callback) {
+    aggregateCallback = callback;
+  }
+
+  /**
+   * In-network aggregation statistics
+   */
+  aggregate::AggregateStats getAggregateStats() {
+    if (!this->aggregator) return aggregate::AggregateStats();
+    return this->aggregator->stats;
+  }
+
   //
   // Message Queue API
   //
@@ -2267,6 +3327,17 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     return painlessmesh::layout::asList(this->asNodeTree(), includeSelf);
   }
 
+  /**
+   * Shape of the mesh as currently known
+   *
+   * Reports the average and maximum number of hops to the root and how much
+   * of the mesh depends on the links of the root. Useful to see the effect of
+   * the parent selection (see StationScan::parentScore()).
+   */
+  layout::TopologyStats getTopologyStats() {
+    return layout::topologyStats(this->asNodeTree());
+  }
+
   /**
    * Return a json representation of the current mesh layout
    */
@@ -3101,7 +4172,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     Log(S_TIME, "startTimeSync(): from %u with %u\n", this->nodeId,
         conn->nodeId);
     painlessmesh::protocol::TimeSync timeSync;
-    if (ntp::adopt(this->asNodeTree(), (*conn))) {
+    if (ntp::adopt(*this, conn)) {
       timeSync = painlessmesh::protocol::TimeSync(this->nodeId, conn->nodeId,
                                                   this->getNodeTime());
       Log(S_TIME, "startTimeSync(): Requesting time from %u\n", conn->nodeId);
@@ -3110,6 +4181,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
       Log(S_TIME, "startTimeSync(): Requesting %u to adopt our time\n",
           conn->nodeId);
     }
+    ntp::stampTimeQuality(*this, timeSync);
     router::send<protocol::TimeSync, T>(timeSync, conn, true);
   }
 
@@ -3162,6 +4234,201 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
     return false;
   }
 
+  /**
+   * Keep the subtree as is while we look for a new parent
+   *
+   * \return false if there is no subtree to keep, the change should be
+   * announced as usual
+   */
+  bool startHandover(uint32_t parentId) {
+    using namespace logger;
+    if (parentId == 0 || this->handover.active()) return false;
+    bool children = false;
+    for (auto &&sub : this->subs) {
+      if (!sub->station && sub->connected() && sub->nodeId != 0)
+        children = true;
+    }
+    if (!children) return false;
+    auto id = this->handover.start(parentId, millis());
+    Log(CONNECTION, "startHandover(): Lost parent %u, keeping subtree\n",
+        parentId);
+    this->addTask(
+        [this, id]() {
+          if (!this->handover.isCurrent(id)) return;
+          auto parent = this->handover.lostParent();
+          this->handover.finish(false, millis());
+          Log(CONNECTION, "startHandover(): No new parent found, announcing\n");
+          this->changedConnectionCallbacks.execute(parent);
+        },
+        HANDOVER_TIMEOUT);
+    return true;
+  }
+
+  void finishHandover(uint32_t nodeId) {
+    using namespace logger;
+    std::shared_ptr<T> parent;
+    for (auto &&sub : this->subs) {
+      if (sub->station && sub->nodeId == nodeId) parent = sub;
+    }
+    // A new child, we are still looking for a parent
+    if (!parent) return;
+    auto held = this->handover.finish(true, millis());
+    Log(CONNECTION, "finishHandover(): New parent %u, sending %u held\n",
+        nodeId, held.size());
+    for (auto &&msg : held) {
+      auto conn =
+          msg.dest == 0 ? parent : router::findRoute<T>((*this), msg.dest);
+      if (conn && router::queueMessage(conn, msg.msg, msg.deadline))
+        ++this->handover.stats.flushed;
+      else
+        ++this->handover.stats.dropped;
+    }
+  }
+
+  uint32_t localDeadline(uint32_t ttlMs) {
+    uint32_t deadline = millis() + ttlMs;
+    return deadline == 0 ? 1 : deadline;
+  }
+
+  bool acquireSendWindow(uint32_t destId) {
+    auto now = millis();
+    // Our own queue towards the destination counts as well
+    auto conn = router::findRoute<T>((*this), destId);
+    if (conn && conn->queueSize() >= FLOW_CONTROL_THRESHOLD)
+      flowWindow.onCredit(destId,
+                          flowcontrol::suggestedWindow(conn->queueSize()), now);
+    if (flowWindow.tryAcquire(destId, now)) return true;
+    Log(logger::COMMUNICATION, "Send window to %u used up (%u)\n", destId,
+        flowWindow.window(destId));
+    return false;
+  }
+
+  void processReliable() {
+    std::list<reliable::ReliablePackage> retransmit;
+    std::list<std::pair<uint32_t, uint32_t>> failed;
+    reliableSender.due(this->nodeId, millis(), retransmit, failed);
+    for (auto &&pkg : retransmit) {
+      Log(logger::COMMUNICATION, "processReliable(): retransmit %u to %u\n",
+          pkg.seq, pkg.dest);
+      this->sendPackage(&pkg);
+    }
+    for (auto &&f : failed) {
+      Log(logger::COMMUNICATION, "processReliable(): giving up on %u to %u\n",
+          f.second, f.first);
+      if (reliableDeliveryCallback)
+        reliableDeliveryCallback(f.first, f.second, false);
+    }
+    if (reliableSender.pending() == 0 && reliableTask != nullptr) {
+      reliableTask->disable();
+      reliableTask = nullptr;
+    }
+  }
+
+  void processRpc() {
+    rpcCalls.expire(millis());
+    if (rpcCalls.pending() == 0 && rpcTask != nullptr) {
+      rpcTask->disable();
+      rpcTask = nullptr;
+    }
+  }
+
+  void callNotSent(rpc::resultCallback_t callback, TSTRING reason) {
+    if (!callback) return;
+    // Schedule callback to avoid calling it from within call()
+    this->addTask([callback, reason]() { callback(rpc::NOT_SENT, reason); });
+  }
+
+  void deliverTopic(protocol::Variant &variant) {
+    auto pkg = variant.to<pubsub::PublishPackage>();
+    bool delivered = false;
+    for (auto &&sub : topicCallbacks) {
+      if (sub.first != pkg.name) continue;
+      delivered = true;
+      sub.second(pkg.from, pkg.name, pkg.msg);
+    }
+    if (delivered) ++topicsDelivered;
+  }
+
+  /**
+   * Hand the aggregates whose window ended to the application if we are the
+   * sink, otherwise send them on towards it. Aggregates that can't be send
+   * (no sink or no route to it) are merged into the next window.
+   */
+  void flushAggregates() {
+    using namespace logger;
+    if (!this->aggregator) return;
+    auto partials = this->aggregator->due(millis());
+    if (partials.empty()) return;
+    auto& stats = this->aggregator->stats;
+    if (this->aggregator->sink() == this->nodeId) {
+      for (auto &&partial : partials) {
+        ++stats.delivered;
+        if (aggregateCallback) aggregateCallback(partial);
+      }
+      return;
+    }
+    aggregate::AggregatePackage pkg;
+    pkg.from = this->nodeId;
+    pkg.dest = this->aggregator->sink();
+    for (size_t i = 0; i < partials.size(); i += AGGREGATE_MAX_KEYS) {
+      auto end = (std::min)(partials.size(), i + AGGREGATE_MAX_KEYS);
+      pkg.partials.assign(partials.begin() + i, partials.begin() + end);
+      if (pkg.dest != 0 && this->sendPackage(&pkg)) {
+        ++stats.sent;
+      } else {
+        // Keep the readings, they go out with the next window
+        this->aggregator->merge(pkg);
+        ++stats.unsent;
+        Log(COMMUNICATION, "flushAggregates(): No route to sink %u\n",
+            pkg.dest);
+      }
+    }
+  }
+
+  void updateSubscribedTopics() {
+    std::vector<uint32_t> topics;
+    for (auto &&sub : topicCallbacks)
+      topics.push_back(pubsub::topicHash(sub.first));
+    std::sort(topics.begin(), topics.end());
+    topics.erase(std::unique(topics.begin(), topics.end()), topics.end());
+    if (topics == subscribedTopics) return;
+    subscribedTopics = topics;
+    // Let our neighbours know
+    for (auto &&conn : this->subs) {
+      if (conn->connected() && !conn->newConnection && conn->nodeId != 0)
+        conn->nodeSyncTask.forceNextIteration();
+    }
+  }
+
+  /**
+   * Hand out slots to the nodes that joined
+   *
+   * \param all Also send the unchanged assignments again
+   */
+  void assignTransmitSlots(bool all = false) {
+    using namespace logger;
+    std::list<std::pair<uint32_t, uint16_t>> changed =
+        slotAssigner.update(this->getNodeList(true), transmitSlotCount);
+    if (all)
+      changed.assign(slotAssigner.assignments().begin(),
+                     slotAssigner.assignments().end());
+    for (auto&& assignment : changed) {
+      if (assignment.first == this->nodeId) {
+        transmitSlot = assignment.second;
+        transmitSlotAssigned = true;
+        continue;
+      }
+      slots::SlotAssignmentPackage pkg;
+      pkg.from = this->nodeId;
+      pkg.dest = assignment.first;
+      pkg.slot = assignment.second;
+      pkg.slotCount = transmitSlotCount;
+      Log(GENERAL, "assignTransmitSlots(): slot %u to %u\n", pkg.slot,
+          pkg.dest);
+      this->sendPackage(&pkg);
+    }
+  }
+
   void eraseClosedConnections() {
     using namespace logger;
     Log(CONNECTION, "eraseClosedConnections():\n");
@@ -3186,6 +4453,54 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
   
   // Message queue for offline mode
   MessageQueue* messageQueue = nullptr;
+
+  // Transmission slots
+  uint16_t transmitSlot = 0;
+  uint16_t transmitSlotCount = TRANSMIT_SLOT_COUNT;
+  bool transmitSlotAssigned = false;
+  bool slotAssignmentEnabled = false;
+  slots::SlotAssigner slotAssigner;
+  std::shared_ptr<Task> slotRefreshTask = nullptr;
+
+  // Publish/subscribe
+  std::vector<uint32_t> subscribedTopics;  // Sorted topic hashes
+  std::list<std::pair<TSTRING, topicReceivedCallback_t>> topicCallbacks;
+  uint32_t topicsPublished = 0;
+  uint32_t topicsDelivered = 0;
+
+  // Reliable delivery
+  reliable::ReliableSender reliableSender;
+  reliable::ReliableReceiver reliableReceiver;
+  reliableDeliveryCallback_t reliableDeliveryCallback;
+  std::shared_ptr<Task> reliableTask = nullptr;
+
+  rpc::CallTable rpcCalls;
+  std::map<TSTRING, rpc::methodHandler_t> rpcMethods;
+  std::shared_ptr<Task> rpcTask = nullptr;
+
+  // Routing state, used by router::routePackage()
+  handover::HandoverBuffer handover;
+  anycast::GatewayDirectory gatewayDirectory;
+  hoplimit::HopLimits hopLimits;
+  // Only set once aggregation is enabled
+  std::shared_ptr<aggregate::Aggregator> aggregator;
+  // Only set once a rate limit is set
+  std::shared_ptr<ratelimit::RateLimiter> rateLimiter;
+  // Limits every received message is checked against before it is parsed
+  validation::ValidationConfig validationConfig = validation::routerConfig();
+
+  // In-network aggregation
+  aggregateCallback_t aggregateCallback;
+  std::shared_ptr<Task> aggregateTask = nullptr;
+
+  // Flow control
+  flowcontrol::FlowWindow flowWindow;
+
+  // Send queue limits
+  size_t queueMaxMessages = MAX_MESSAGE_QUEUE;
+  size_t queueMaxBytes = MAX_MESSAGE_QUEUE_BYTES;
+  buffer::DropPolicy queueDropPolicy = buffer::DROP_LOWEST_PRIORITY;
+  queueWatermarkCallback_t queueWatermarkCallback;
   
 #ifdef ESP32
   SemaphoreHandle_t xSemaphore = NULL;
@@ -3231,6 +4546,7 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
   uint32_t bridgeStatusIntervalMs = 30000;  // Default 30 seconds
   uint32_t bridgeTimeoutMs = 60000;         // Default 60 seconds
   bool bridgeStatusBroadcastEnabled = true;
+  bool bridgeStatusCompat = false;  // Full status instead of keepalives
   
   // Bridge cleanup configuration
   static const size_t MAX_KNOWN_BRIDGES = 20;  // Memory efficient limit for ESP8266
@@ -3261,6 +4577,11 @@ class Mesh : public ntp::MeshTime, public plugin::PackageHandler<T> {
   uint8_t internetRetryCount = 3;            // Default 3 retries
   uint32_t internetRetryDelay = 1000;        // Default 1 second base delay
   bool sendToInternetEnabled = false;
+  bool gatewayAnycast = false;
+  bool uplinkStriping = false;
+  striping::StripeScheduler stripeScheduler;
+  std::list<uint32_t> stripeBacklog;
+  uint32_t stripeSequence = 0;
 
   friend T;
   friend void onDataCb(void *, AsyncClient *, void *, size_t);
@@ -3288,6 +4609,21 @@ class Connection : public painlessmesh::layout::Neighbour,
   Task nodeSyncTask;
   Task timeOutTask;
 
+  // Time hierarchy position last advertised by the remote node
+  uint8_t timeStratum = protocol::TIME_STRATUM_UNSYNCED;
+  uint32_t timeError = 0;
+
+  // Packages that had expired when they arrived over this connection
+  uint32_t expiredMessages = 0;
+
+  // Messages received over this connection that failed the checks before
+  // parsing (see validation::scanMessage())
+  validation::RejectionStats rejectedMessages;
+
+  // Last flow control feedback send to nodes behind this connection
+  bool flowFeedbackSent = false;
+  uint32_t lastFlowFeedback = 0;
+
   // Connection metrics tracking
   uint32_t messagesRx = 0;
   uint32_t messagesTx = 0;
@@ -3309,9 +4645,17 @@ class Connection : public painlessmesh::layout::Neighbour,
   void initTasks() {
     auto self = this->shared_from_this();
     auto mesh = this->mesh;
+    this->setQueueLimits(mesh->queueMaxMessages, mesh->queueMaxBytes,
+                         mesh->queueDropPolicy);
+    // The buffer belongs to this connection, so it can't outlive it
+    this->sentBuffer.onWatermark([mesh, this](bool high) {
+      Log(logger::COMMUNICATION, "Send queue to %u %s watermark\n",
+          this->nodeId, high ? "above high" : "below low");
+      if (mesh->queueWatermarkCallback)
+        mesh->queueWatermarkCallback(this->nodeId, high);
+    });
     this->onReceive([self](const TSTRING &str) {
-      auto variant = painlessmesh::protocol::Variant(str);
-
+      // routePackage() validates the raw frame before anything is parsed
       router::routePackage<painlessmesh::Connection>(
           (*self->mesh), self->shared_from_this(), str,
           self->mesh->callbackList, self->mesh->getNodeTime());
@@ -3328,7 +4672,9 @@ class Connection : public painlessmesh::layout::Neighbour,
       auto nodeId = self->nodeId;
       auto station = self->station;
       mesh->addTask([mesh, nodeId, station]() {
-        mesh->changedConnectionCallbacks.execute(nodeId);
+        // Losing our parent is only announced if no new one is found in time
+        if (!station || !mesh->startHandover(nodeId))
+          mesh->changedConnectionCallbacks.execute(nodeId);
         mesh->droppedConnectionCallbacks.execute(nodeId, station);
       });
       self->clear();
@@ -3345,8 +4691,9 @@ class Connection : public painlessmesh::layout::Neighbour,
 
     this->nodeSyncTask.set(TASK_MINUTE, TASK_FOREVER, [self]() {
       Log(SYNC, "nodeSyncTask(): request with %u\n", self->nodeId);
-      router::send<protocol::NodeSyncRequest, Connection>(
-          self->request(self->mesh->asNodeTree()), self);
+      auto request = self->request(self->mesh->asNodeTree());
+      router::advertiseTopics(*self->mesh, self, request);
+      router::send<protocol::NodeSyncRequest, Connection>(request, self);
       self->timeOutTask.disable();
       self->timeOutTask.restartDelayed();
     });
@@ -3370,9 +4717,13 @@ class Connection : public painlessmesh::layout::Neighbour,
    * 
    * \param msg The message to send
    * \param priorityLevel Priority level: 0=CRITICAL, 1=HIGH, 2=NORMAL, 3=LOW
+   * \param deadline Drop the message if it is not send before this time
+   * (millis()), 0 for no deadline
+   * \param key Replace a queued message with the same key, 0 for none
    */
-  bool addMessageWithPriority(const TSTRING &msg, uint8_t priorityLevel) {
-    return this->writeWithPriority(msg, priorityLevel);
+  bool addMessageWithPriority(const TSTRING &msg, uint8_t priorityLevel,
+                              uint32_t deadline = 0, uint64_t key = 0) {
+    return this->writeWithPriority(msg, priorityLevel, deadline, key);
   }
 
   /**
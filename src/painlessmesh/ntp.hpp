@@ -13,6 +13,38 @@
 #define MIN_LARGE_OFFSET_STEP 500  // Minimum offset size before softening
 #endif
 
+#ifndef TIME_SYNC_INTERVAL_MAX
+#define TIME_SYNC_INTERVAL_MAX \
+  4 * TASK_MINUTE  // Upper bound of the adaptive resync period
+#endif
+
+#ifndef TIME_SYNC_SAMPLES
+#define TIME_SYNC_SAMPLES 8  // Size of the clock filter sample window
+#endif
+
+#ifndef TIME_SYNC_BURST
+#define TIME_SYNC_BURST \
+  4  // Samples taken in quick succession after (re)acquiring the clock
+#endif
+
+#ifndef TIME_SYNC_MIN_SPAN
+#define TIME_SYNC_MIN_SPAN \
+  30000000  // Minimum time covered by the samples before estimating drift (us)
+#endif
+
+#ifndef MAX_SLEW_PPM
+#define MAX_SLEW_PPM 500  // Maximum rate at which small offsets are slewed away
+#endif
+
+#ifndef MAX_DRIFT_PPM
+#define MAX_DRIFT_PPM 500  // Largest clock drift we consider plausible
+#endif
+
+#ifndef TIME_ERROR_GROWTH_PPM
+#define TIME_ERROR_GROWTH_PPM \
+  20  // Rate at which the estimated error grows in between syncs
+#endif
+
 #ifndef MAX_CPU_TRIP_RATIO
 #define MAX_CPU_TRIP_RATIO \
   85  // Maximum ratio between remote cpu time and trip time for NTP calc to be
@@ -21,6 +53,8 @@
 
 #include "Arduino.h"
 
+#include <algorithm>
+
 #include "painlessmesh/callback.hpp"
 #include "painlessmesh/logger.hpp"
 #include "painlessmesh/router.hpp"
@@ -30,22 +64,424 @@ extern painlessmesh::logger::LogClass Log;
 namespace painlessmesh {
 namespace ntp {
 
+/**
+ * Single time sync measurement, as stored by the ClockFilter
+ */
+struct clock_sample_t {
+  uint32_t local;  // micros() when the reply arrived
+  uint32_t phase;  // Remote time minus micros() at that moment
+  uint32_t rtt;    // Round trip time, excluding the remote processing time
+};
+
+/**
+ * Keeps a small window of time sync samples and estimates the remote clock
+ *
+ * Only the samples with the lowest round trip times are used, because their
+ * offset error is bounded by half their round trip time. If the samples cover
+ * enough time a least squares fit gives the drift between both clocks.
+ */
+class ClockFilter {
+ public:
+  void add(uint32_t local, uint32_t phase, uint32_t rtt) {
+    // Differences between samples are calculated as int32_t, so drop anything
+    // that is about to become ambiguous because of the micros() roll over
+    while (count > 0 && local - oldest().local > 0x60000000) --count;
+    samples[next] = {local, phase, rtt};
+    next = (next + 1) % TIME_SYNC_SAMPLES;
+    if (count < TIME_SYNC_SAMPLES) ++count;
+  }
+
+  /**
+   * Estimate the phase (remote time minus micros()) at the given local time
+   *
+   * \param drift Estimated drift in ppb. Used as input if there are not
+   * enough samples to estimate it, otherwise updated
+   *
+   * \return Whether the drift was estimated from the samples
+   */
+  bool estimate(uint32_t local, uint32_t& phase, int32_t& drift) const {
+    if (count == 0) return false;
+
+    // Select the faster half of the samples
+    uint32_t rtts[TIME_SYNC_SAMPLES];
+    for (uint8_t i = 0; i < count; ++i) rtts[i] = at(i).rtt;
+    std::sort(rtts, rtts + count);
+    auto threshold = rtts[(count - 1) / 2];
+
+    const clock_sample_t* best = &at(0);
+    for (uint8_t i = 1; i < count; ++i)
+      if (at(i).rtt < best->rtt) best = &at(i);
+
+    uint8_t n = 0;
+    double sx = 0, sy = 0;
+    int32_t minX = 0, maxX = 0;
+    for (uint8_t i = 0; i < count; ++i) {
+      if (at(i).rtt > threshold) continue;
+      auto x = (int32_t)(at(i).local - best->local);
+      sx += x;
+      sy += (int32_t)(at(i).phase - best->phase);
+      minX = (std::min)(minX, x);
+      maxX = (std::max)(maxX, x);
+      ++n;
+    }
+
+    bool fitted = false;
+    double offset = 0;  // Phase relative to best at time x = meanX
+    double meanX = 0;
+    if (n >= 3 && maxX - minX >= TIME_SYNC_MIN_SPAN) {
+      meanX = sx / n;
+      offset = sy / n;
+      double sxx = 0, sxy = 0;
+      for (uint8_t i = 0; i < count; ++i) {
+        if (at(i).rtt > threshold) continue;
+        auto dx = (int32_t)(at(i).local - best->local) - meanX;
+        auto dy = (int32_t)(at(i).phase - best->phase) - offset;
+        sxx += dx * dx;
+        sxy += dx * dy;
+      }
+      auto ppb = sxy / sxx * 1e9;
+      if (ppb > MAX_DRIFT_PPM * 1000) ppb = MAX_DRIFT_PPM * 1000;
+      if (ppb < -MAX_DRIFT_PPM * 1000) ppb = -MAX_DRIFT_PPM * 1000;
+      drift = (int32_t)ppb;
+      fitted = true;
+    }
+
+    auto dt = (int32_t)(local - best->local) - meanX;
+    phase = best->phase + (int32_t)(offset + dt * drift / 1e9);
+    return fitted;
+  }
+
+  /** Lowest round trip time in the window (0 if empty) */
+  uint32_t minRtt() const {
+    uint32_t rtt = 0;
+    for (uint8_t i = 0; i < count; ++i)
+      if (i == 0 || at(i).rtt < rtt) rtt = at(i).rtt;
+    return rtt;
+  }
+
+  size_t size() const { return count; }
+
+  void clear() { count = 0; }
+
+ protected:
+  // i = 0 is the oldest sample
+  const clock_sample_t& at(uint8_t i) const {
+    return samples[(next + TIME_SYNC_SAMPLES - count + i) % TIME_SYNC_SAMPLES];
+  }
+  const clock_sample_t& oldest() const { return at(0); }
+
+  clock_sample_t samples[TIME_SYNC_SAMPLES];
+  uint8_t next = 0;
+  uint8_t count = 0;
+};
+
+/**
+ * Time synchronisation statistics, see MeshTime::getTimeSyncStats()
+ */
+struct TimeSyncStats {
+  uint32_t samples = 0;       // Time replies processed
+  uint32_t rejected = 0;      // Replies discarded as outliers
+  uint32_t steps = 0;         // Times the clock was stepped instead of slewed
+  int32_t lastError = 0;      // Last estimated offset of our clock (us)
+  int32_t driftPpb = 0;       // Estimated drift relative to our time source
+  uint32_t minRtt = 0;        // Lowest round trip time in the sample window
+  uint32_t syncInterval = 0;  // Current resync interval (ms)
+  uint32_t timeSource = 0;    // Node we currently follow (0 if none)
+  uint8_t stratum = protocol::TIME_STRATUM_UNSYNCED;
+  uint32_t estimatedError = 0;  // Estimated error of our time (us)
+  uint32_t propagations = 0;  // Times we pushed our time to other nodes
+};
+
+/**
+ * Position of a node in the time hierarchy, as advertised in TimeSync packages
+ */
+struct time_quality_t {
+  uint8_t stratum;
+  uint32_t error;
+};
+
 class MeshTime {
  public:
   /** Returns the mesh time in microsecond precision.
    *
-   * Time rolls over every 71 minutes.
+   * Time rolls over every 71 minutes. Use getNodeTime64() if you need
+   * timestamps that can be compared across roll overs.
    *
    * Nodes try to keep a common time base synchronizing to each other using [an
    * SNTP based
    * protocol](https://gitlab.com/painlessMesh/painlessMesh/wikis/mesh-protocol#time-sync)
+   *
+   * The estimated drift relative to the time source is compensated for and
+   * small corrections are slewed in gradually, so the time does not jump
+   * during normal operation.
+   */
+  uint32_t getNodeTime() {
+    uint32_t now = micros() + currentOffset();
+    // Count the roll overs. The time can be stepped back, also across a roll
+    // over, so check in which direction we moved
+    auto diff = (int32_t)(now - lastNodeTime);
+    if (diff > 0 && now < lastNodeTime)
+      ++nodeTimeEpoch;
+    else if (diff < 0 && now > lastNodeTime)
+      --nodeTimeEpoch;
+    lastNodeTime = now;
+    return now;
+  }
+
+  /**
+   * Returns the mesh time in microseconds as a 64 bit value, which does not
+   * roll over
+   *
+   * The lower 32 bits are equal to getNodeTime(). The number of roll overs is
+   * synchronised along with the time, so nodes agree on the full value as
+   * long as their time source runs a version that shares it. Otherwise it
+   * counts from the moment this node started.
+   *
+   * The time needs to be requested at least every 35 minutes to keep track of
+   * the roll overs, which the mesh takes care of.
+   */
+  uint64_t getNodeTime64() {
+    uint32_t now = getNodeTime();
+    return ((uint64_t)nodeTimeEpoch << 32) | now;
+  }
+
+  /**
+   * Convert a (recent) 32 bit mesh time to the 64 bit mesh time
+   *
+   * Useful for timestamps received from other nodes. The result is the 64 bit
+   * time closest to now with the same lower 32 bits, so it is correct for
+   * timestamps less than 35 minutes away from now.
+   */
+  uint64_t toNodeTime64(uint32_t nodeTime) {
+    auto now = getNodeTime64();
+    return now + (int32_t)(nodeTime - (uint32_t)now);
+  }
+
+  /**
+   * Statistics of the time synchronisation
+   *
+   * Useful to judge the accuracy of the mesh time against the number of time
+   * sync messages needed to get there.
+   */
+  TimeSyncStats getTimeSyncStats() const {
+    auto stats = timeSyncStats;
+    stats.driftPpb = driftPpb;
+    stats.minRtt = clockFilter.minRtt();
+    stats.syncInterval = syncInterval;
+    stats.timeSource = timeSource;
+    stats.stratum = getTimeStratum();
+    stats.estimatedError = getTimeError();
+    return stats;
+  }
+
+  /**
+   * Time stratum, i.e. the number of hops to the time authority we follow
+   *
+   * Returns protocol::TIME_STRATUM_UNSYNCED if we don't follow a time
+   * authority or have not been able to sync with our time source for a while.
+   * Note that nodes with time authority are stratum 0, which is handled by
+   * the mesh itself.
+   */
+  uint8_t getTimeStratum() const {
+    if (timeStratum >= protocol::TIME_STRATUM_UNSYNCED ||
+        millis() - lastSyncAt > 3 * (uint32_t)(TIME_SYNC_INTERVAL_MAX))
+      return protocol::TIME_STRATUM_UNSYNCED;
+    return timeStratum;
+  }
+
+  /**
+   * Estimated error of our time relative to the time authority (us)
+   *
+   * This is the error advertised by our time source, plus our own
+   * measurement error and drift since the last sync.
+   */
+  uint32_t getTimeError() const {
+    uint64_t error = timeError + (uint64_t)(millis() - lastSyncAt) *
+                                     TIME_ERROR_GROWTH_PPM / 1000;
+    return (uint32_t)(std::min)(error, (uint64_t)0xFFFFFFFF);
+  }
+
+  /**
+   * Process a time sync measurement
+   *
+   * \param offset Ntp offset of the remote clock relative to our node time
+   * \param rtt Round trip time of the exchange
+   *
+   * \return The correction that is stepped or slewed into our node time
+   */
+  int32_t adjustTime(int32_t offset, uint32_t rtt) {
+    ++timeSyncStats.samples;
+    auto base = currentOffset();
+    uint32_t local = micros();
+    uint32_t phase = base + offset;
+
+    // A jump larger than the measurement error means the remote clock was
+    // stepped, so older samples are no longer valid
+    if (clockFilter.size() > 0) {
+      uint32_t expected;
+      auto drift = driftPpb;
+      clockFilter.estimate(local, expected, drift);
+      auto diff = (int32_t)(phase - expected);
+      if (diff > TIME_SYNC_ACCURACY + (int32_t)(rtt / 2) ||
+          diff < -TIME_SYNC_ACCURACY - (int32_t)(rtt / 2))
+        clockFilter.clear();
+    }
+    clockFilter.add(local, phase, rtt);
+
+    uint32_t target;
+    clockFilter.estimate(local, target, driftPpb);
+    auto error = (int32_t)(target - base);
+    timeSyncStats.lastError = error;
+
+    if (error >= TIME_SYNC_ACCURACY || error <= -TIME_SYNC_ACCURACY) {
+      timeOffset += error;
+      stepped = true;
+      slewRemaining = 0;
+      slewAllowance = 0;
+      syncInterval = TIME_SYNC_INTERVAL;
+      burstRemaining = TIME_SYNC_BURST;
+      ++timeSyncStats.steps;
+      return error;
+    }
+
+    slewRemaining = error;
+    if (burstRemaining > 0) {
+      --burstRemaining;
+    } else if (error < TIME_SYNC_ACCURACY / 4 &&
+               error > -TIME_SYNC_ACCURACY / 4) {
+      // Estimate is stable, so we can back off
+      syncInterval =
+          (std::min)(syncInterval * 2, (uint32_t)(TIME_SYNC_INTERVAL_MAX));
+    } else {
+      syncInterval =
+          (std::max)(syncInterval / 2, (uint32_t)(TIME_SYNC_INTERVAL));
+    }
+    return error;
+  }
+
+  /**
+   * Align our roll over count with that of our time source
+   *
+   * \param epoch Roll over count of the remote node at the given time
+   * \param time Remote node time at which the epoch was valid
+   */
+  void adoptEpoch(uint32_t epoch, uint32_t time) {
+    auto now = getNodeTime();
+    auto remote = (((uint64_t)epoch << 32) | time) + (int32_t)(now - time);
+    nodeTimeEpoch = (uint32_t)(remote >> 32);
+  }
+
+  /** Whether we are still collecting the initial burst of samples */
+  bool isAcquiringTime() const { return burstRemaining > 0; }
+
+  /**
+   * Record the quality of the time source we just synced with
+   */
+  void setTimeSource(uint32_t nodeId, uint8_t stratum, uint32_t error) {
+    timeSource = nodeId;
+    if (stratum >= protocol::TIME_STRATUM_UNSYNCED - 1)
+      timeStratum = protocol::TIME_STRATUM_UNSYNCED;
+    else
+      timeStratum = stratum + 1;
+    auto offset = timeSyncStats.lastError;
+    timeError = error + clockFilter.minRtt() / 2 +
+                (uint32_t)(offset < 0 ? -offset : offset);
+    lastSyncAt = millis();
+  }
+
+  /**
+   * Whether our time improved enough to be worth pushing to the nodes that
+   * follow us
+   *
+   * That is the case after the clock was stepped, when we moved closer to a
+   * time authority or when the estimated error dropped by more than half the
+   * sync accuracy. Small refinements are picked up by the other nodes during
+   * their own regular syncs, which avoids sync cascades through the mesh.
    */
-  uint32_t getNodeTime() { return micros() + timeOffset; }
+  bool timeImproved() {
+    auto stratum = getTimeStratum();
+    auto error = getTimeError();
+    if (!stepped && stratum >= propagatedStratum &&
+        error + TIME_SYNC_ACCURACY / 2 >= propagatedError)
+      return false;
+    stepped = false;
+    propagatedStratum = stratum;
+    propagatedError = error;
+    ++timeSyncStats.propagations;
+    return true;
+  }
 
  public:  // Windows MSVC: friend functions need access to timeOffset
   uint32_t timeOffset = 0;
+  int32_t driftPpb = 0;  // Drift of our time source relative to micros()
+  uint32_t syncInterval = (uint32_t)(TIME_SYNC_INTERVAL);
+  uint32_t timeSource = 0;
+  ClockFilter clockFilter;
+  TimeSyncStats timeSyncStats;
+
+ protected:
+  /**
+   * Apply drift compensation and slewing accumulated since the last call
+   */
+  uint32_t currentOffset() {
+    uint32_t now = micros();
+    uint32_t elapsed = now - lastOffsetUpdate;
+    if (elapsed == 0) return timeOffset;
+    lastOffsetUpdate = now;
+
+    int64_t drift = (int64_t)elapsed * driftPpb + driftRemainder;
+    auto whole = (int32_t)(drift / 1000000000);
+    driftRemainder = drift - (int64_t)whole * 1000000000;
+    timeOffset += whole;
+
+    if (slewRemaining != 0) {
+      // Frequent calls each allow less than 1us, so carry the allowance over
+      slewAllowance += (int64_t)elapsed * MAX_SLEW_PPM;
+      auto maxStep = slewAllowance / 1000000;
+      int32_t step = slewRemaining;
+      if (step > maxStep) step = (int32_t)maxStep;
+      if (step < -maxStep) step = -(int32_t)maxStep;
+      timeOffset += step;
+      slewRemaining -= step;
+      slewAllowance -= (int64_t)(step < 0 ? -step : step) * 1000000;
+      if (slewRemaining == 0) slewAllowance = 0;
+    }
+    return timeOffset;
+  }
+
+  int32_t slewRemaining = 0;
+  int64_t slewAllowance = 0;  // Slew allowed but not applied yet, in ppm*us
+  int64_t driftRemainder = 0;
+  uint32_t lastOffsetUpdate = 0;
+  uint32_t lastNodeTime = 0;
+  uint32_t nodeTimeEpoch = 0;
+  uint8_t burstRemaining = TIME_SYNC_BURST;
+
+  uint8_t timeStratum = protocol::TIME_STRATUM_UNSYNCED;
+  uint32_t timeError = 0;
+  uint32_t lastSyncAt = 0;
+  bool stepped = false;
+  uint8_t propagatedStratum = protocol::TIME_STRATUM_UNSYNCED;
+  uint32_t propagatedError = 0xFFFFFFFF;
 };
 
+/**
+ * Calculate the offset of the local clock using the ntp algorithm, without
+ * any softening
+ */
+inline int32_t rawClockOffset(uint32_t time0, uint32_t time1, uint32_t time2,
+                              uint32_t time3) {
+  return ((int32_t)(time1 - time0) / 2) + ((int32_t)(time2 - time3) / 2);
+}
+
+/**
+ * Whether the trip took unreasonably long compared to the remote cpu time
+ */
+inline bool isTripOutlier(uint32_t time0, uint32_t time1, uint32_t time2,
+                          uint32_t time3) {
+  return (time3 - time0) > (time2 - time1) * MAX_CPU_TRIP_RATIO;
+}
+
 /**
  * Calculate the offset of the local clock using the ntp algorithm
  *
@@ -53,15 +489,14 @@ class MeshTime {
  */
 inline int32_t clockOffset(uint32_t time0, uint32_t time1, uint32_t time2,
                            uint32_t time3) {
-  uint32_t offset =
-      ((int32_t)(time1 - time0) / 2) + ((int32_t)(time2 - time3) / 2);
+  uint32_t offset = rawClockOffset(time0, time1, time2, time3);
 
   // Take small steps to avoid over correction
   int32_t signedOffset = (int32_t)offset;
   if (abs(signedOffset) < MIN_LARGE_OFFSET_STEP && abs(signedOffset) > 4)
     signedOffset = signedOffset / 4;
   // Discard outliers with excessive trip to cpu ratios
-  if ((time3 - time0) > (time2 - time1) * MAX_CPU_TRIP_RATIO) signedOffset = 0;
+  if (isTripOutlier(time0, time1, time2, time3)) signedOffset = 0;
   return signedOffset;
 }
 
@@ -107,6 +542,83 @@ inline bool adopt(protocol::NodeTree mesh, protocol::NodeTree connection) {
   return true;
 }
 
+/**
+ * Our own position in the time hierarchy
+ */
+template <class T>
+time_quality_t timeQuality(T& mesh) {
+  if (mesh.getTimeAuthority()) return {0, 0};
+  return {mesh.getTimeStratum(), mesh.getTimeError()};
+}
+
+/**
+ * Position of a neighbour in the time hierarchy, as last advertised by it
+ */
+template <class U>
+time_quality_t remoteTimeQuality(const std::shared_ptr<U>& connection) {
+  // Older nodes don't advertise a stratum, but do share their time authority
+  if (connection->hasTimeAuthority) return {0, 0};
+  return {connection->timeStratum, connection->timeError};
+}
+
+/**
+ * Whether time source a is better than b
+ *
+ * Sources closer to a time authority always win. Otherwise the one with the
+ * lowest estimated error wins, with some bias towards our current source to
+ * avoid flapping between sources of comparable quality.
+ */
+inline bool isBetterTimeSource(time_quality_t a, uint32_t idA,
+                               time_quality_t b, uint32_t idB,
+                               uint32_t current) {
+  if (a.stratum != b.stratum) return a.stratum < b.stratum;
+  const uint32_t margin = TIME_SYNC_ACCURACY / 2;
+  if (idA == current) return a.error <= b.error + margin;
+  if (idB == current) return a.error + margin < b.error;
+  if (a.error != b.error) return a.error < b.error;
+  return idA < idB;
+}
+
+/**
+ * Decide whether we should adopt the time of the connection
+ *
+ * When either side is synced to a time authority we follow the best time
+ * source among all our connections, and only if it is closer to the authority
+ * than we are. Otherwise we fall back to the subtree size based logic of
+ * adopt(protocol::NodeTree, protocol::NodeTree).
+ */
+template <class T, class U>
+bool adopt(T& mesh, std::shared_ptr<U> connection) {
+  auto mine = timeQuality(mesh);
+  auto theirs = remoteTimeQuality(connection);
+  if (mine.stratum >= protocol::TIME_STRATUM_UNSYNCED &&
+      theirs.stratum >= protocol::TIME_STRATUM_UNSYNCED)
+    return adopt(mesh.asNodeTree(), (*connection));
+
+  if (theirs.stratum >= mine.stratum) return false;
+
+  for (auto&& other : mesh.subs) {
+    if (other == connection || other->nodeId == 0) continue;
+    if (isBetterTimeSource(remoteTimeQuality(other), other->nodeId, theirs,
+                           connection->nodeId, mesh.timeSource)) {
+      Log(logger::S_TIME, "adopt(): %u is a better time source than %u\n",
+          other->nodeId, connection->nodeId);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Advertise our position in the time hierarchy in a time sync message
+ */
+template <class T>
+void stampTimeQuality(T& mesh, protocol::TimeSync& timeSync) {
+  auto quality = timeQuality(mesh);
+  timeSync.msg.stratum = quality.stratum;
+  timeSync.msg.error = quality.error;
+}
+
 template <class T>
 void initTimeSync(protocol::NodeTree mesh, std::shared_ptr<T> connection,
                   uint32_t nodeTime) {
@@ -130,6 +642,9 @@ void initTimeSync(protocol::NodeTree mesh, std::shared_ptr<T> connection,
 template <class T, class U>
 void handleTimeSync(T& mesh, painlessmesh::protocol::TimeSync timeSync,
                     std::shared_ptr<U> conn, uint32_t receivedAt) {
+  conn->timeStratum = timeSync.msg.stratum;
+  conn->timeError = timeSync.msg.error;
+
   switch (timeSync.msg.type) {
     case (painlessmesh::protocol::TIME_SYNC_ERROR):
       Log(logger::ERROR,
@@ -143,45 +658,83 @@ void handleTimeSync(T& mesh, painlessmesh::protocol::TimeSync timeSync,
           "handleTimeSync(): Received requesto to start TimeSync with "
           "node: %u\n",
           conn->nodeId);
-      timeSync.reply(mesh.getNodeTime());
+      if (timeQuality(mesh).stratum < remoteTimeQuality(conn).stratum) {
+        // We are closer to a time authority, ask them to adopt ours instead
+        Log(logger::S_TIME,
+            "handleTimeSync(): Not adopting from %u, offering our time\n",
+            conn->nodeId);
+        timeSync = protocol::TimeSync(mesh.nodeId, conn->nodeId);
+      } else {
+        timeSync.reply(mesh.getNodeTime());
+      }
+      stampTimeQuality(mesh, timeSync);
       router::send<painlessmesh::protocol::TimeSync>(timeSync, conn, true);
       break;
 
-    case (painlessmesh::protocol::TIME_REQUEST):
-      timeSync.reply(receivedAt, mesh.getNodeTime());
+    case (painlessmesh::protocol::TIME_REQUEST): {
+      auto now = mesh.getNodeTime64();
+      timeSync.reply(receivedAt, (uint32_t)now);
+      timeSync.msg.epoch = (uint32_t)(now >> 32);
+      timeSync.msg.hasEpoch = true;
+      stampTimeQuality(mesh, timeSync);
       router::send<painlessmesh::protocol::TimeSync>(timeSync, conn, true);
 
       Log(logger::S_TIME,
           "handleTimeSync(): timeSyncStatus with %u completed\n", conn->nodeId);
 
-      // After response is sent I assume sync is completed
-      conn->timeSyncTask.delay(TIME_SYNC_INTERVAL);
+      // After response is sent I assume sync is completed. The other side
+      // decides when to sync again, so stay quiet for longer than it would
+      conn->timeSyncTask.delay(TIME_SYNC_INTERVAL_MAX + TIME_SYNC_INTERVAL);
       break;
+    }
 
     case (painlessmesh::protocol::TIME_REPLY): {
       Log(logger::S_TIME,
           "handleTimeSync(): %u adopting TIME_RESPONSE from %u\n", mesh.nodeId,
           conn->nodeId);
-      int32_t offset = painlessmesh::ntp::clockOffset(
-          timeSync.msg.t0, timeSync.msg.t1, timeSync.msg.t2, receivedAt);
-      mesh.timeOffset += offset;  // Accumulate offset
+      auto& msg = timeSync.msg;
+      if (remoteTimeQuality(conn).stratum < protocol::TIME_STRATUM_UNSYNCED &&
+          !adopt(mesh, conn)) {
+        // We were asked to sync, but follow a better time source
+        conn->timeSyncTask.delay(mesh.syncInterval);
+        Log(logger::S_TIME,
+            "handleTimeSync(): ignoring time from %u, not our time source\n",
+            conn->nodeId);
+        break;
+      }
+      if (painlessmesh::ntp::isTripOutlier(msg.t0, msg.t1, msg.t2,
+                                           receivedAt)) {
+        ++mesh.timeSyncStats.rejected;
+        conn->timeSyncTask.delay(200 * TASK_MILLISECOND);
+        Log(logger::S_TIME,
+            "handleTimeSync(): discarded slow reply from %u, retrying\n",
+            conn->nodeId);
+        break;
+      }
+      int32_t offset = mesh.adjustTime(
+          painlessmesh::ntp::rawClockOffset(msg.t0, msg.t1, msg.t2,
+                                            receivedAt),
+          (receivedAt - msg.t0) - (msg.t2 - msg.t1));
+      mesh.setTimeSource(conn->nodeId, msg.stratum, msg.error);
+      if (msg.hasEpoch) mesh.adoptEpoch(msg.epoch, msg.t2);
 
-      // flag all connections for re-timeSync
       if (mesh.nodeTimeAdjustedCallback) {
         mesh.nodeTimeAdjustedCallback(offset);
       }
 
-      if ((offset < TIME_SYNC_ACCURACY) && (offset > -TIME_SYNC_ACCURACY) &&
-          (offset != 0)) {
-        // mark complete only if offset was less than 10 ms
-        conn->timeSyncTask.delay(TIME_SYNC_INTERVAL);
+      if (!mesh.isAcquiringTime()) {
+        conn->timeSyncTask.delay(mesh.syncInterval);
         Log(logger::S_TIME,
-            "handleTimeSync(): timeSyncStatus with %u completed\n",
-            conn->nodeId);
+            "handleTimeSync(): timeSyncStatus with %u completed, next in "
+            "%u ms\n",
+            conn->nodeId, mesh.syncInterval);
 
-        // Time has changed, update other nodes
+        // Only update the nodes following us if our time improved
+        // significantly, they pick up small refinements on their next sync
+        if (!mesh.timeImproved()) break;
         for (auto&& connection : mesh.subs) {
-          if (connection->nodeId != conn->nodeId) {  // exclude this connection
+          if (connection->nodeId != conn->nodeId &&  // exclude this connection
+              connection->nodeId != 0 && !adopt(mesh, connection)) {
             connection->timeSyncTask.forceNextIteration();
             Log(logger::S_TIME,
                 "handleTimeSync(): timeSyncStatus with %u brought forward\n",
@@ -189,7 +742,7 @@ void handleTimeSync(T& mesh, painlessmesh::protocol::TimeSync timeSync,
           }
         }
       } else {
-        // Iterate sync procedure if accuracy was not enough
+        // Collect a few samples in quick succession to fill the clock filter
         conn->timeSyncTask.delay(200 * TASK_MILLISECOND);  // Small delay
         Log(logger::S_TIME,
             "handleTimeSync(): timeSyncStatus with %u needs further tries\n",
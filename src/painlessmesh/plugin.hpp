@@ -5,6 +5,7 @@
 #include "painlessmesh/configuration.hpp"
 
 #include "painlessmesh/router.hpp"
+#include <algorithm>
 #include <vector>
 
 namespace painlessmesh {
@@ -94,6 +95,120 @@ class NeighbourPackage : public plugin::SinglePackage {
   NeighbourPackage(JsonObject jsonObj) : SinglePackage(jsonObj) {}
 };
 
+/**
+ * Bridge Status Package (Type 610)
+ *
+ * Broadcast periodically by bridges to report their Internet connectivity.
+ * Bridges also send it directly to nodes that just joined, in which case
+ * routing is SINGLE and dest is set.
+ *
+ * Wire compatible with alteriom::BridgeStatusPackage. When nothing changed
+ * since the last full status, bridges send a compact keepalive instead, with
+ * only the base fields, "same" and "next" set. Receivers keep the bridge for
+ * at least twice "next", so keepalives can be further apart than their time
+ * out. Older receivers ignore keepalives, see Mesh::setBridgeStatusCompat().
+ */
+class BridgeStatusPackage : public plugin::BroadcastPackage {
+ public:
+  bool internetConnected = false;  // Is the bridge connected to Internet?
+  int8_t routerRSSI = 0;           // Router WiFi signal strength in dBm
+  uint8_t routerChannel = 0;       // Router WiFi channel
+  uint32_t uptime = 0;             // Bridge uptime in milliseconds
+  TSTRING gatewayIP = "";          // Router gateway IP address
+  uint32_t timestamp = 0;          // Mesh time of the status check
+  uint16_t messageType = protocol::BRIDGE_STATUS;  // MQTT schema message_type
+  uint32_t dest = 0;               // Only used with SINGLE routing
+  bool hasStatus = true;           // False if the status fields are missing
+  bool unchanged = false;          // Compact keepalive, status as before
+  uint8_t capacity = 0;            // Relative uplink capacity, 0 if unknown
+  uint32_t next = 0;               // Keepalives: ms until the next one at most
+  int noJsonFields = 13;           // Base fields (3) + new fields (10)
+
+  BridgeStatusPackage() : BroadcastPackage(protocol::BRIDGE_STATUS) {}
+
+  BridgeStatusPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj) {
+    hasStatus = jsonObj["internetConnected"].is<bool>();
+    internetConnected = jsonObj["internetConnected"] | false;
+    routerRSSI = jsonObj["routerRSSI"] | 0;
+    routerChannel = jsonObj["routerChannel"] | 0;
+    uptime = jsonObj["uptime"] | 0;
+    gatewayIP = jsonObj["gatewayIP"].as<TSTRING>();
+    timestamp = jsonObj["timestamp"] | 0;
+    messageType = jsonObj["message_type"] | protocol::BRIDGE_STATUS;
+    dest = jsonObj["dest"] | 0;
+    unchanged = jsonObj["same"] | false;
+    capacity = jsonObj["capacity"] | 0;
+    next = jsonObj["next"] | 0;
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = BroadcastPackage::addTo(std::move(jsonObj));
+    if (routing == router::SINGLE) jsonObj["dest"] = dest;
+    if (unchanged) {
+      jsonObj["same"] = true;
+      if (next > 0) jsonObj["next"] = next;
+      return jsonObj;
+    }
+    jsonObj["internetConnected"] = internetConnected;
+    jsonObj["routerRSSI"] = routerRSSI;
+    jsonObj["routerChannel"] = routerChannel;
+    jsonObj["uptime"] = uptime;
+    jsonObj["gatewayIP"] = gatewayIP;
+    jsonObj["timestamp"] = timestamp;
+    jsonObj["message_type"] = messageType;
+    if (capacity > 0) jsonObj["capacity"] = capacity;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields) + gatewayIP.length();
+  }
+#endif
+};
+
+/**
+ * Decides when a bridge should announce its state again
+ *
+ * Changes are announced right away. Without changes the time between
+ * keepalives doubles, from the base interval up to the maximum. Receivers
+ * only keep the bridge past their own time out if the keepalive tells them
+ * when to expect the next one (current()).
+ */
+class AnnounceBackoff {
+ public:
+  /**
+   * Whether an announcement is due
+   *
+   * \param changed The state changed since the last announcement
+   */
+  bool due(bool changed, uint32_t now, uint32_t baseMs, uint32_t maxMs) {
+    if (changed || !started) {
+      reset(now, baseMs);
+      return true;
+    }
+    if (now - last < interval) return false;
+    last = now;
+    interval = (std::max)(baseMs, (std::min)(interval * 2, maxMs));
+    return true;
+  }
+
+  /// Start over with the base interval, e.g. after sending a full update
+  void reset(uint32_t now, uint32_t baseMs) {
+    started = true;
+    last = now;
+    interval = baseMs;
+  }
+
+  /// Current time between keepalives
+  uint32_t current() const { return interval; }
+
+ protected:
+  bool started = false;
+  uint32_t last = 0;
+  uint32_t interval = 0;
+};
+
 /**
  * Bridge Coordination Package (Type 613)
  * 
@@ -117,7 +232,8 @@ class BridgeCoordinationPackage : public plugin::BroadcastPackage {
   std::vector<uint32_t> peerBridges;  // List of known bridge node IDs
   uint8_t load = 0;               // Current load percentage (0-100)
   uint32_t timestamp = 0;         // Coordination timestamp
-  int noJsonFields = 8;           // Base fields (3) + new fields (5)
+  uint32_t next = 0;              // ms until the next message at most, 0 if unknown
+  int noJsonFields = 9;           // Base fields (3) + new fields (6)
 
   BridgeCoordinationPackage() : BroadcastPackage(613) {}
 
@@ -126,6 +242,7 @@ class BridgeCoordinationPackage : public plugin::BroadcastPackage {
     role = jsonObj["role"].as<TSTRING>();
     load = jsonObj["load"] | 0;
     timestamp = jsonObj["timestamp"] | 0;
+    next = jsonObj["next"] | 0;
     
     // Parse peer bridge array
     if (jsonObj["peerBridges"].is<JsonArray>()) {
@@ -142,6 +259,7 @@ class BridgeCoordinationPackage : public plugin::BroadcastPackage {
     jsonObj["role"] = role;
     jsonObj["load"] = load;
     jsonObj["timestamp"] = timestamp;
+    if (next > 0) jsonObj["next"] = next;
     
     // Add peer bridge array
     JsonArray peers = jsonObj["peerBridges"].to<JsonArray>();
@@ -3,6 +3,7 @@
 
 #include <cmath>
 #include <list>
+#include <vector>
 
 #include "Arduino.h"
 
@@ -49,6 +50,10 @@ enum TimeType {
   TIME_REPLY
 };
 
+// Time stratum of nodes that do not (or no longer) follow a time authority.
+// Nodes with time authority are stratum 0, every hop away from it adds one.
+constexpr uint8_t TIME_STRATUM_UNSYNCED = 16;
+
 // Bridge protocol package types
 // These are used for bridge discovery, election, and coordination
 constexpr int BRIDGE_STATUS = 610;      // Bridge status broadcast (internet, RSSI, etc.)
@@ -62,6 +67,30 @@ constexpr int GATEWAY_DATA = 620;       // Gateway data package for Internet rou
 constexpr int GATEWAY_ACK = 621;        // Gateway acknowledgment package
 constexpr int GATEWAY_HEARTBEAT = 622;  // Gateway heartbeat for health monitoring
 
+// Destination of single packages that should go to the nearest healthy
+// gateway, resolved by every router on the way (see anycast.hpp)
+constexpr uint32_t ANY_GATEWAY = 0xFFFFFFFE;
+
+// Mesh scheduling protocol types
+constexpr int TRANSMIT_SLOT = 630;      // Transmission slot assignment by the root
+
+// Publish/subscribe protocol types
+constexpr int PUBLISH = 640;            // Message on a topic, only routed to subscribers
+
+// Reliable delivery protocol types
+constexpr int RELIABLE_DATA = 650;      // Single message that is acknowledged by the destination
+constexpr int RELIABLE_ACK = 651;       // Acknowledgement of reliable messages
+
+// Flow control protocol types
+constexpr int FLOW_CONTROL = 660;       // Credit feedback from a congested relay
+
+// In-network aggregation protocol types
+constexpr int AGGREGATE = 670;          // Partial aggregates on their way to the sink
+
+// Request/response protocol types
+constexpr int RPC_REQUEST = 680;        // Call of a method on another node
+constexpr int RPC_RESPONSE = 681;       // Result of a call
+
 class PackageInterface {
  public:
   virtual JsonObject addTo(JsonObject&& jsonObj) const = 0;
@@ -81,6 +110,8 @@ class Single : public PackageInterface {
   uint32_t from;
   uint32_t dest;
   TSTRING msg = "";
+  uint32_t deadline = 0;  // Mesh time after which the message is dropped
+  uint32_t key = 0;       // Coalescing key, newer messages replace older ones
 
   Single() {}
   Single(uint32_t fromID, uint32_t destID, TSTRING& message) {
@@ -93,6 +124,8 @@ class Single : public PackageInterface {
     dest = jsonObj["dest"].as<uint32_t>();
     from = jsonObj["from"].as<uint32_t>();
     msg = jsonObj["msg"].as<TSTRING>();
+    deadline = jsonObj["deadline"] | 0u;
+    key = jsonObj["ckey"] | 0u;
   }
 
   JsonObject addTo(JsonObject&& jsonObj) const {
@@ -100,12 +133,14 @@ class Single : public PackageInterface {
     jsonObj["dest"] = dest;
     jsonObj["from"] = from;
     jsonObj["msg"] = msg;
+    if (deadline != 0) jsonObj["deadline"] = deadline;
+    if (key != 0) jsonObj["ckey"] = key;
     return jsonObj;
   }
 
 #if ARDUINOJSON_VERSION_MAJOR < 7
   size_t jsonObjectSize() const {
-    return JSON_OBJECT_SIZE(4) + ceil(1.1 * msg.length());
+    return JSON_OBJECT_SIZE(6) + ceil(1.1 * msg.length());
   }
 #endif
 };
@@ -127,7 +162,7 @@ class Broadcast : public Single {
 
 #if ARDUINOJSON_VERSION_MAJOR < 7
   size_t jsonObjectSize() const {
-    return JSON_OBJECT_SIZE(4) + ceil(1.1 * msg.length());
+    return JSON_OBJECT_SIZE(6) + ceil(1.1 * msg.length());
   }
 #endif
 };
@@ -247,6 +282,10 @@ class NodeSyncRequest : public NodeTree {
   int type = NODE_SYNC_REQUEST;
   uint32_t from;
   uint32_t dest;
+  // Topic hashes subscribed to by the sender and the nodes behind it (except
+  // those behind the receiver). Not send by older nodes or if unknown.
+  std::vector<uint32_t> topics;
+  bool hasTopics = false;
 
   NodeSyncRequest() {}
   NodeSyncRequest(uint32_t fromID, uint32_t destID, std::list<NodeTree> subTree,
@@ -261,6 +300,16 @@ class NodeSyncRequest : public NodeTree {
   NodeSyncRequest(JsonObject jsonObj) : NodeTree(jsonObj) {
     dest = jsonObj["dest"].as<uint32_t>();
     from = jsonObj["from"].as<uint32_t>();
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("topics")) {
+#else
+    if (jsonObj["topics"].is<JsonArray>()) {
+#endif
+      hasTopics = true;
+      auto jsonArr = jsonObj["topics"].as<JsonArray>();
+      for (size_t i = 0; i < jsonArr.size(); ++i)
+        topics.push_back(jsonArr[i].as<uint32_t>());
+    }
   }
 
   JsonObject addTo(JsonObject&& jsonObj) const {
@@ -268,6 +317,14 @@ class NodeSyncRequest : public NodeTree {
     jsonObj["type"] = type;
     jsonObj["dest"] = dest;
     jsonObj["from"] = from;
+    if (hasTopics) {
+#if ARDUINOJSON_VERSION_MAJOR == 7
+      JsonArray topicsArr = jsonObj["topics"].to<JsonArray>();
+#else
+      JsonArray topicsArr = jsonObj.createNestedArray("topics");
+#endif
+      for (auto&& topic : topics) topicsArr.add(topic);
+    }
     return jsonObj;
   }
 
@@ -286,8 +343,10 @@ class NodeSyncRequest : public NodeTree {
     if (root) ++base;
     if (hasTimeAuthority) ++base;
     if (subs.size() > 0) ++base;
+    if (hasTopics) ++base;
     size_t size = JSON_OBJECT_SIZE(base);
     if (subs.size() > 0) size += JSON_ARRAY_SIZE(subs.size());
+    if (hasTopics) size += JSON_ARRAY_SIZE(topics.size());
     for (auto&& s : subs) size += s.jsonObjectSize();
     return size;
   }
@@ -315,6 +374,10 @@ struct time_sync_msg_t {
   uint32_t t0 = 0;
   uint32_t t1 = 0;
   uint32_t t2 = 0;
+  uint8_t stratum = TIME_STRATUM_UNSYNCED;  // Stratum of the sender
+  uint32_t error = 0;  // Estimated error of the sender's time (us)
+  uint32_t epoch = 0;  // Roll overs of the sender's time at t2
+  bool hasEpoch = false;
 };
 
 /**
@@ -371,6 +434,14 @@ class TimeSync : public PackageInterface {
       msg.t1 = jsonObj["msg"]["t1"].as<uint32_t>();
     if (jsonObj["msg"].containsKey("t2"))
       msg.t2 = jsonObj["msg"]["t2"].as<uint32_t>();
+    if (jsonObj["msg"].containsKey("stratum"))
+      msg.stratum = jsonObj["msg"]["stratum"].as<uint8_t>();
+    if (jsonObj["msg"].containsKey("err"))
+      msg.error = jsonObj["msg"]["err"].as<uint32_t>();
+    if (jsonObj["msg"].containsKey("epoch")) {
+      msg.epoch = jsonObj["msg"]["epoch"].as<uint32_t>();
+      msg.hasEpoch = true;
+    }
 #else
     if (jsonObj["msg"]["t0"].is<uint32_t>())
       msg.t0 = jsonObj["msg"]["t0"].as<uint32_t>();
@@ -378,6 +449,14 @@ class TimeSync : public PackageInterface {
       msg.t1 = jsonObj["msg"]["t1"].as<uint32_t>();
     if (jsonObj["msg"]["t2"].is<uint32_t>())
       msg.t2 = jsonObj["msg"]["t2"].as<uint32_t>();
+    if (jsonObj["msg"]["stratum"].is<uint8_t>())
+      msg.stratum = jsonObj["msg"]["stratum"].as<uint8_t>();
+    if (jsonObj["msg"]["err"].is<uint32_t>())
+      msg.error = jsonObj["msg"]["err"].as<uint32_t>();
+    if (jsonObj["msg"]["epoch"].is<uint32_t>()) {
+      msg.epoch = jsonObj["msg"]["epoch"].as<uint32_t>();
+      msg.hasEpoch = true;
+    }
 #endif
   }
 
@@ -395,6 +474,12 @@ class TimeSync : public PackageInterface {
     if (msg.type >= 2) {
       msgObj["t1"] = msg.t1;
       msgObj["t2"] = msg.t2;
+      if (msg.hasEpoch) msgObj["epoch"] = msg.epoch;
+    }
+    // Older nodes ignore these, and treat us as they always did
+    if (msg.stratum < TIME_STRATUM_UNSYNCED) {
+      msgObj["stratum"] = msg.stratum;
+      msgObj["err"] = msg.error;
     }
     return jsonObj;
   }
@@ -420,7 +505,7 @@ class TimeSync : public PackageInterface {
 
 #if ARDUINOJSON_VERSION_MAJOR < 7
   size_t jsonObjectSize() const {
-    return JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(4);
+    return JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(7);
   }
 #endif
 };
@@ -749,6 +834,78 @@ class Variant {
     return 0;
   }
 
+  /**
+   * Source node of the package
+   */
+  uint32_t from() {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("from")) return jsonObj["from"].as<uint32_t>();
+#else
+    if (jsonObj["from"].is<uint32_t>()) return jsonObj["from"].as<uint32_t>();
+#endif
+    return 0;
+  }
+
+  /**
+   * Mesh time after which the package should be dropped, 0 if it never
+   * expires
+   */
+  uint32_t deadline() {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("deadline"))
+      return jsonObj["deadline"].as<uint32_t>();
+#else
+    if (jsonObj["deadline"].is<uint32_t>())
+      return jsonObj["deadline"].as<uint32_t>();
+#endif
+    return 0;
+  }
+
+  /**
+   * Coalescing key of the package, or 0 if it has none
+   *
+   * The key is only unique per sending node.
+   */
+  uint32_t coalesceKey() {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("ckey")) return jsonObj["ckey"].as<uint32_t>();
+#else
+    if (jsonObj["ckey"].is<uint32_t>()) return jsonObj["ckey"].as<uint32_t>();
+#endif
+    return 0;
+  }
+
+  /**
+   * Topic hash of the package, or 0 if it has no topic
+   */
+  uint32_t topic() {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("topic")) return jsonObj["topic"].as<uint32_t>();
+#else
+    if (jsonObj["topic"].is<uint32_t>())
+      return jsonObj["topic"].as<uint32_t>();
+#endif
+    return 0;
+  }
+
+  /**
+   * Hops the package may still travel, -1 if it has no hop limit (see
+   * hoplimit.hpp)
+   */
+  int ttl() {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("ttl")) return jsonObj["ttl"].as<int>();
+#else
+    if (jsonObj["ttl"].is<int>()) return jsonObj["ttl"].as<int>();
+#endif
+    return -1;
+  }
+
+  /**
+   * Set the hops the package may still travel
+   */
+  void ttl(uint8_t hops) { jsonObj["ttl"] = hops; }
+
 #ifdef ARDUINOJSON_ENABLE_STD_STRING
   /**
    * Print a variant to a string
@@ -0,0 +1,92 @@
+#ifndef _PAINLESS_MESH_PUBSUB_HPP_
+#define _PAINLESS_MESH_PUBSUB_HPP_
+
+/**
+ * @file pubsub.hpp
+ * @brief Topic based publish/subscribe
+ *
+ * Normal broadcasts are flooded to every node in the mesh. Messages published
+ * on a topic are only forwarded into the parts of the mesh where some node
+ * subscribed to that topic.
+ *
+ * Every node advertises a hash of the topics it (and the nodes behind it)
+ * subscribed to during the regular node sync with its neighbours. Routers use
+ * this to skip connections without interested nodes (see
+ * router::broadcastTopic()). Older nodes don't advertise topics, so they (and
+ * anything behind them) always receive all topic messages.
+ */
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/plugin.hpp"
+#include "painlessmesh/protocol.hpp"
+
+namespace painlessmesh {
+namespace pubsub {
+
+/**
+ * Hash of a topic name (32 bit FNV-1a)
+ *
+ * Never returns 0, which is used for messages without a topic.
+ */
+inline uint32_t topicHash(const TSTRING& topic) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < topic.length(); ++i) {
+    hash ^= (uint8_t)topic[i];
+    hash *= 16777619u;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+/**
+ * Message published on a topic
+ *
+ * Type ID: 640 (PUBLISH)
+ * Base class: BroadcastPackage (pruned to subtrees with subscribers)
+ */
+class PublishPackage : public plugin::BroadcastPackage {
+ public:
+  uint32_t topic = 0;  // topicHash(name), used for routing
+  TSTRING name = "";   // Topic name, to resolve hash collisions
+  TSTRING msg = "";
+
+  static constexpr int numPackageFields = 3;
+
+  PublishPackage() : BroadcastPackage(protocol::PUBLISH) {}
+
+  PublishPackage(JsonObject jsonObj) : BroadcastPackage(jsonObj) {
+    topic = jsonObj["topic"];
+    name = jsonObj["name"].as<TSTRING>();
+    msg = jsonObj["msg"].as<TSTRING>();
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = BroadcastPackage::addTo(std::move(jsonObj));
+    jsonObj["topic"] = topic;
+    jsonObj["name"] = name;
+    jsonObj["msg"] = msg;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields) + name.length() +
+           msg.length();
+  }
+#endif
+};
+
+/**
+ * Publish/subscribe statistics, see Mesh::getPubSubStats()
+ */
+struct PubSubStats {
+  uint32_t published = 0;   // Messages published by this node
+  uint32_t delivered = 0;   // Messages delivered to our own subscribers
+  uint32_t suppressed = 0;  // Transmissions skipped on current connections
+  size_t topics = 0;        // Topics this node subscribed to
+};
+
+}  // namespace pubsub
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_PUBSUB_HPP_
@@ -0,0 +1,192 @@
+#ifndef _PAINLESS_MESH_RATELIMIT_HPP_
+#define _PAINLESS_MESH_RATELIMIT_HPP_
+
+/**
+ * @file ratelimit.hpp
+ * @brief Per origin rate limits at relays
+ *
+ * Every relay forwards every broadcast, so a single node that floods the mesh
+ * (e.g. an application calling sendBroadcast() in a tight loop) saturates
+ * every link in the tree. With rate limits set (see Mesh::setRateLimit()) a
+ * node drops messages from an origin that exceeds its limit, instead of
+ * handling and forwarding them.
+ *
+ * Limits are token buckets: an origin can send burst messages at once, and
+ * rate messages per second after that. A limit is either set for a single
+ * package type, or for ANY_TYPE. Messages of types without a limit of their
+ * own share the ANY_TYPE bucket of their origin. The mesh's own time and node
+ * sync packages are never limited by the ANY_TYPE limit.
+ *
+ * The state is a fixed size table of RATE_LIMIT_BUCKETS buckets. When it is
+ * full the bucket that was used least recently is reused.
+ */
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/protocol.hpp"
+
+#ifndef RATE_LIMIT_BUCKETS
+#define RATE_LIMIT_BUCKETS 32  // Origin/type pairs tracked at the same time
+#endif
+#ifndef RATE_LIMIT_RULES
+#define RATE_LIMIT_RULES 8  // Package types with a limit of their own
+#endif
+
+namespace painlessmesh {
+namespace ratelimit {
+
+// Limit for all package types without a limit of their own
+constexpr int ANY_TYPE = 0;
+
+/**
+ * Rate limit statistics, see Mesh::getRateLimitStats()
+ */
+struct RateLimitStats {
+  uint32_t allowed = 0;  // Messages within their limit
+  uint32_t limited = 0;  // Messages dropped because their origin was over it
+  uint32_t evicted = 0;  // Buckets reused for another origin
+};
+
+/**
+ * Token buckets for all origins and limited package types
+ */
+class RateLimiter {
+ public:
+  /**
+   * Limit messages of type from each origin
+   *
+   * \param type Package type or ANY_TYPE
+   * \param ratePerSecond Messages per second, 0 removes the limit
+   * \param burst Messages an origin can send at once
+   *
+   * \return false if there are already RATE_LIMIT_RULES limits
+   */
+  bool setLimit(int type, uint16_t ratePerSecond, uint16_t burst) {
+    if (ratePerSecond == 0) {
+      removeLimit(type);
+      return true;
+    }
+    Rule* free = nullptr;
+    for (auto&& rule : rules) {
+      if (rule.rate != 0 && rule.type == type) {
+        free = &rule;
+        break;
+      }
+      if (rule.rate == 0 && free == nullptr) free = &rule;
+    }
+    if (free == nullptr) return false;
+    free->type = type;
+    free->rate = ratePerSecond;
+    free->burst = burst > 0 ? burst : 1;
+    forget(type);
+    return true;
+  }
+
+  void removeLimit(int type) {
+    for (auto&& rule : rules) {
+      if (rule.rate != 0 && rule.type == type) rule.rate = 0;
+    }
+    forget(type);
+  }
+
+  /// Whether any limit is set
+  bool active() const {
+    for (auto&& rule : rules) {
+      if (rule.rate != 0) return true;
+    }
+    return false;
+  }
+
+  /**
+   * Take a token for a message
+   *
+   * \return false if the origin is over its limit for this type
+   */
+  bool allow(uint32_t origin, int type, uint32_t now) {
+    auto rule = ruleFor(type);
+    if (rule == nullptr) return true;
+    auto& bucket = bucketFor(origin, rule, now);
+    refill(bucket, *rule, now);
+    if (bucket.tokens < TOKEN) {
+      ++stats.limited;
+      return false;
+    }
+    bucket.tokens -= TOKEN;
+    ++stats.allowed;
+    return true;
+  }
+
+  RateLimitStats stats;
+
+ protected:
+  // Tokens are counted in thousandths, so refills per ms don't round to zero
+  static constexpr uint32_t TOKEN = 1000;
+
+  struct Rule {
+    int16_t type = ANY_TYPE;
+    uint16_t rate = 0;  // 0 if unused
+    uint16_t burst = 0;
+  };
+
+  struct Bucket {
+    uint32_t origin = 0;  // 0 if unused
+    int16_t type = ANY_TYPE;
+    uint32_t tokens = 0;
+    uint32_t lastMs = 0;
+  };
+
+  const Rule* ruleFor(int type) const {
+    const Rule* any = nullptr;
+    for (auto&& rule : rules) {
+      if (rule.rate == 0) continue;
+      if (rule.type == type) return &rule;
+      if (rule.type == ANY_TYPE) any = &rule;
+    }
+    // Don't let a limit for everything break time and node sync
+    if (type < protocol::BROADCAST) return nullptr;
+    return any;
+  }
+
+  Bucket& bucketFor(uint32_t origin, const Rule* rule, uint32_t now) {
+    Bucket* oldest = &buckets[0];
+    for (auto&& bucket : buckets) {
+      if (bucket.origin == origin && bucket.type == rule->type) return bucket;
+      if (oldest->origin != 0 &&
+          (bucket.origin == 0 || (int32_t)(bucket.lastMs - oldest->lastMs) < 0))
+        oldest = &bucket;
+    }
+    if (oldest->origin != 0) ++stats.evicted;
+    oldest->origin = origin;
+    oldest->type = rule->type;
+    oldest->tokens = (uint32_t)rule->burst * TOKEN;
+    oldest->lastMs = now;
+    return *oldest;
+  }
+
+  void refill(Bucket& bucket, const Rule& rule, uint32_t now) {
+    uint32_t full = (uint32_t)rule.burst * TOKEN;
+    uint32_t elapsed = now - bucket.lastMs;
+    bucket.lastMs = now;
+    // Rate is per second and tokens are in thousandths, so one per ms
+    if (elapsed >= full / rule.rate + 1) {
+      bucket.tokens = full;
+      return;
+    }
+    bucket.tokens += elapsed * rule.rate;
+    if (bucket.tokens > full) bucket.tokens = full;
+  }
+
+  void forget(int type) {
+    for (auto&& bucket : buckets) {
+      if (bucket.type == type) bucket.origin = 0;
+    }
+  }
+
+  Rule rules[RATE_LIMIT_RULES];
+  Bucket buckets[RATE_LIMIT_BUCKETS];
+};
+
+}  // namespace ratelimit
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_RATELIMIT_HPP_
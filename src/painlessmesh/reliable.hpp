@@ -0,0 +1,500 @@
+#ifndef _PAINLESS_MESH_RELIABLE_HPP_
+#define _PAINLESS_MESH_RELIABLE_HPP_
+
+/**
+ * @file reliable.hpp
+ * @brief Reliable end-to-end delivery of single messages
+ *
+ * Messages send with Mesh::sendSingle() are lost when a connection drops
+ * while they are underway. Reliable messages carry a sequence number and are
+ * acknowledged by the destination. The sender retransmits them until they are
+ * acknowledged, using a retransmission timeout (RTO) that follows the measured
+ * round trip time to that destination (RFC 6298).
+ *
+ * Acknowledgements are cumulative (all sequence numbers below `ack` arrived)
+ * with a short selective list on top, so one lost acknowledgement does not
+ * cause retransmission of everything that was send after it. The receiver
+ * uses a MessageTracker to drop retransmitted duplicates.
+ *
+ * Sequence numbers are counted per destination, within a session that is
+ * picked at random when the sender starts talking to that destination.
+ * Senders and receivers keep state for at most RELIABLE_MAX_PEERS nodes.
+ */
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/message_tracker.hpp"
+#include "painlessmesh/plugin.hpp"
+#include "painlessmesh/protocol.hpp"
+#include "painlessmesh/validation.hpp"
+
+#ifndef RELIABLE_MAX_PENDING
+#define RELIABLE_MAX_PENDING 8  // Unacknowledged messages per destination
+#endif
+#ifndef RELIABLE_MAX_RETRIES
+#define RELIABLE_MAX_RETRIES 5
+#endif
+#ifndef RELIABLE_INITIAL_RTO
+#define RELIABLE_INITIAL_RTO 1000  // ms, until the first RTT sample
+#endif
+#ifndef RELIABLE_MIN_RTO
+#define RELIABLE_MIN_RTO 200  // ms
+#endif
+#ifndef RELIABLE_MAX_RTO
+#define RELIABLE_MAX_RTO 16000  // ms
+#endif
+#ifndef RELIABLE_MAX_SACK
+#define RELIABLE_MAX_SACK 8  // Selective acks per acknowledgement
+#endif
+#ifndef RELIABLE_MAX_PEERS
+#define RELIABLE_MAX_PEERS 16  // Nodes we keep send and receive state for
+#endif
+#ifndef RELIABLE_TICK
+#define RELIABLE_TICK 50  // ms between retransmission checks
+#endif
+
+namespace painlessmesh {
+namespace reliable {
+
+/**
+ * True if sequence number a comes before b (handles roll over)
+ */
+inline bool seqBefore(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+/**
+ * MessageTracker id of a message
+ *
+ * Mixes the session into all bits, so the sequence numbers of two sessions
+ * of the same sender don't simply map onto each other, as with session + seq.
+ */
+inline uint32_t trackerId(uint32_t session, uint32_t seq) {
+  uint32_t h = session ^ (seq * 0x9E3779B1u);
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+/**
+ * Reliable message
+ *
+ * Type ID: 650 (RELIABLE_DATA)
+ * Base class: SinglePackage
+ */
+class ReliablePackage : public plugin::SinglePackage {
+ public:
+  uint32_t session = 0;  // Random per boot of the sender
+  uint32_t seq = 0;
+  TSTRING msg = "";
+
+  static constexpr int numPackageFields = 3;
+
+  ReliablePackage() : SinglePackage(protocol::RELIABLE_DATA) {}
+
+  ReliablePackage(JsonObject jsonObj) : SinglePackage(jsonObj) {
+    session = jsonObj["sid"];
+    seq = jsonObj["seq"];
+    msg = jsonObj["msg"].as<TSTRING>();
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = SinglePackage::addTo(std::move(jsonObj));
+    jsonObj["sid"] = session;
+    jsonObj["seq"] = seq;
+    jsonObj["msg"] = msg;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields) +
+           ceil(1.1 * msg.length());
+  }
+#endif
+};
+
+/**
+ * Acknowledgement of reliable messages
+ *
+ * Type ID: 651 (RELIABLE_ACK)
+ * Base class: SinglePackage
+ */
+class ReliableAckPackage : public plugin::SinglePackage {
+ public:
+  uint32_t session = 0;  // Session of the sender we acknowledge
+  uint32_t ack = 0;      // All sequence numbers before this one arrived
+  std::list<uint32_t> sack;  // Sequence numbers after ack that arrived
+
+  static constexpr int numPackageFields = 3;
+
+  ReliableAckPackage() : SinglePackage(protocol::RELIABLE_ACK) {}
+
+  ReliableAckPackage(JsonObject jsonObj) : SinglePackage(jsonObj) {
+    session = jsonObj["sid"];
+    ack = jsonObj["ack"];
+#if ARDUINOJSON_VERSION_MAJOR < 7
+    if (jsonObj.containsKey("sack")) {
+#else
+    if (jsonObj["sack"].is<JsonArray>()) {
+#endif
+      JsonArray arr = jsonObj["sack"];
+      for (JsonVariant s : arr) sack.push_back(s.as<uint32_t>());
+    }
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = SinglePackage::addTo(std::move(jsonObj));
+    jsonObj["sid"] = session;
+    jsonObj["ack"] = ack;
+    if (sack.size() > 0) {
+#if ARDUINOJSON_VERSION_MAJOR < 7
+      JsonArray arr = jsonObj.createNestedArray("sack");
+#else
+      JsonArray arr = jsonObj["sack"].to<JsonArray>();
+#endif
+      for (auto&& s : sack) arr.add(s);
+    }
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields) +
+           JSON_ARRAY_SIZE(sack.size());
+  }
+#endif
+};
+
+/**
+ * Retransmission timeout based on smoothed round trip time (RFC 6298)
+ */
+class RttEstimator {
+ public:
+  void sample(uint32_t rtt) {
+    if (srtt == 0) {
+      srtt = rtt;
+      rttvar = rtt / 2;
+    } else {
+      uint32_t delta = rtt > srtt ? rtt - srtt : srtt - rtt;
+      rttvar = (3 * rttvar + delta) / 4;
+      srtt = (7 * srtt + rtt) / 8;
+    }
+    rto = srtt + std::max((uint32_t)RELIABLE_TICK, 4 * rttvar);
+    rto = std::max((uint32_t)(RELIABLE_MIN_RTO), rto);
+    rto = std::min((uint32_t)(RELIABLE_MAX_RTO), rto);
+  }
+
+  uint32_t srtt = 0;  // ms, 0 until the first sample
+  uint32_t rttvar = 0;
+  uint32_t rto = RELIABLE_INITIAL_RTO;
+};
+
+/**
+ * Reliable delivery statistics, see Mesh::getReliableStats()
+ */
+struct ReliableStats {
+  uint32_t sent = 0;             // Messages handed to sendSingleReliable()
+  uint32_t retransmissions = 0;  // Extra transmissions after a timeout
+  uint32_t delivered = 0;        // Messages acknowledged by the destination
+  uint32_t failed = 0;           // Messages given up on after max retries
+  uint32_t received = 0;         // Messages received and passed on
+  uint32_t duplicates = 0;       // Retransmitted messages we dropped
+  uint32_t acksSent = 0;
+  uint32_t skipped = 0;          // Gaps given up on, too much arrived after
+};
+
+/**
+ * Sender side: sequence numbers, unacknowledged messages and timers
+ *
+ * Does not send anything itself; the mesh transmits the packages that are
+ * returned by send() and due().
+ */
+class ReliableSender {
+ public:
+  /**
+   * Queue a new message for destId
+   *
+   * \return The package to transmit, with seq 0 if too many messages to this
+   * destination are still unacknowledged, or messages to RELIABLE_MAX_PEERS
+   * other destinations are
+   */
+  ReliablePackage send(uint32_t from, uint32_t destId, TSTRING msg,
+                       uint32_t now) {
+    ReliablePackage pkg;
+    pkg.from = from;
+    pkg.dest = destId;
+    pkg.msg = msg;
+    auto peerPtr = peerFor(destId, now);
+    if (peerPtr == nullptr) return pkg;
+    auto& peer = *peerPtr;
+    pkg.session = peer.session;
+    peer.lastUsed = now;
+    if (peer.pending.size() >= RELIABLE_MAX_PENDING) return pkg;
+    pkg.seq = peer.nextSeq++;
+    if (peer.nextSeq == 0) peer.nextSeq = 1;
+    Pending pending;
+    pending.msg = msg;
+    pending.sentAt = now;
+    pending.deadline = now + peer.rtt.rto;
+    peer.pending[pkg.seq] = pending;
+    ++stats.sent;
+    return pkg;
+  }
+
+  /**
+   * Process an acknowledgement
+   *
+   * \return Sequence numbers that were acknowledged for the first time
+   */
+  std::list<uint32_t> onAck(const ReliableAckPackage& pkg, uint32_t now) {
+    std::list<uint32_t> acked;
+    auto peerIt = peers.find(pkg.from);
+    if (peerIt == peers.end()) return acked;
+    auto& peer = peerIt->second;
+    if (pkg.session != peer.session) return acked;
+    auto it = peer.pending.begin();
+    while (it != peer.pending.end()) {
+      auto seq = it->first;
+      bool isAcked = seqBefore(seq, pkg.ack) ||
+                     std::find(pkg.sack.begin(), pkg.sack.end(), seq) !=
+                         pkg.sack.end();
+      if (!isAcked) {
+        ++it;
+        continue;
+      }
+      // Karn's algorithm: only measure messages that were send once
+      if (it->second.retries == 0) peer.rtt.sample(now - it->second.sentAt);
+      acked.push_back(seq);
+      ++stats.delivered;
+      it = peer.pending.erase(it);
+    }
+    return acked;
+  }
+
+  /**
+   * Messages whose retransmission timer expired
+   *
+   * \param retransmit Packages that need to be send again
+   * \param failed Destination and sequence number of the messages we give up
+   * on
+   */
+  void due(uint32_t from, uint32_t now, std::list<ReliablePackage>& retransmit,
+           std::list<std::pair<uint32_t, uint32_t>>& failed) {
+    for (auto&& peer : peers) {
+      auto it = peer.second.pending.begin();
+      while (it != peer.second.pending.end()) {
+        auto& pending = it->second;
+        if ((int32_t)(now - pending.deadline) < 0) {
+          ++it;
+          continue;
+        }
+        if (pending.retries >= RELIABLE_MAX_RETRIES) {
+          failed.push_back(std::make_pair(peer.first, it->first));
+          ++stats.failed;
+          it = peer.second.pending.erase(it);
+          continue;
+        }
+        ++pending.retries;
+        ++stats.retransmissions;
+        // Exponential backoff
+        auto rto = std::min((uint32_t)(RELIABLE_MAX_RTO),
+                            peer.second.rtt.rto << pending.retries);
+        pending.deadline = now + rto;
+        ReliablePackage pkg;
+        pkg.from = from;
+        pkg.dest = peer.first;
+        pkg.session = peer.second.session;
+        pkg.seq = it->first;
+        pkg.msg = pending.msg;
+        retransmit.push_back(pkg);
+        ++it;
+      }
+    }
+  }
+
+  /**
+   * Number of messages that are not acknowledged yet
+   */
+  size_t pending() const {
+    size_t n = 0;
+    for (auto&& peer : peers) n += peer.second.pending.size();
+    return n;
+  }
+
+  /**
+   * Current retransmission timeout towards destId (ms)
+   */
+  uint32_t rto(uint32_t destId) const {
+    auto it = peers.find(destId);
+    if (it == peers.end()) return RELIABLE_INITIAL_RTO;
+    return it->second.rtt.rto;
+  }
+
+  /**
+   * Smoothed round trip time towards destId (ms), 0 if not measured yet
+   */
+  uint32_t srtt(uint32_t destId) const {
+    auto it = peers.find(destId);
+    if (it == peers.end()) return 0;
+    return it->second.rtt.srtt;
+  }
+
+  /// Destinations we keep state for
+  size_t size() const { return peers.size(); }
+
+  ReliableStats stats;
+
+ protected:
+  struct Pending {
+    TSTRING msg;
+    uint32_t sentAt = 0;
+    uint32_t deadline = 0;
+    uint8_t retries = 0;
+  };
+
+  struct Peer {
+    // New state starts a new session, so the receiver starts over as well
+    uint32_t session = validation::SecureRandom::generate() | 1;
+    uint32_t nextSeq = 1;
+    std::map<uint32_t, Pending> pending;
+    RttEstimator rtt;
+    uint32_t lastUsed = 0;
+  };
+
+  /**
+   * State for destId, making room by forgetting the destination without
+   * unacknowledged messages that was used least recently
+   *
+   * \return nullptr if all RELIABLE_MAX_PEERS destinations still have
+   * unacknowledged messages
+   */
+  Peer* peerFor(uint32_t destId, uint32_t now) {
+    auto it = peers.find(destId);
+    if (it != peers.end()) return &it->second;
+    if (peers.size() >= RELIABLE_MAX_PEERS) {
+      auto idle = peers.end();
+      for (auto i = peers.begin(); i != peers.end(); ++i) {
+        if (!i->second.pending.empty()) continue;
+        if (idle == peers.end() ||
+            now - i->second.lastUsed > now - idle->second.lastUsed)
+          idle = i;
+      }
+      if (idle == peers.end()) return nullptr;
+      peers.erase(idle);
+    }
+    return &peers[destId];
+  }
+
+  std::map<uint32_t, Peer> peers;
+};
+
+/**
+ * Receiver side: duplicate suppression and acknowledgements
+ */
+class ReliableReceiver {
+ public:
+  ReliableReceiver() : tracker(RELIABLE_MAX_PEERS * 4 * RELIABLE_MAX_PENDING) {}
+
+  /**
+   * Register an incoming message
+   *
+   * \param ack Filled with the acknowledgement to send back
+   *
+   * \return false if the message is a duplicate and should be dropped
+   */
+  bool receive(const ReliablePackage& pkg, uint32_t nodeId, uint32_t now,
+               ReliableAckPackage& ack) {
+    auto& peer = peerFor(pkg.from, now);
+    if (peer.session != pkg.session) {
+      // Sender restarted
+      peer.session = pkg.session;
+      peer.next = 1;
+      peer.received.clear();
+    }
+    peer.lastSeen = now;
+
+    auto trackId = trackerId(pkg.session, pkg.seq);
+    bool duplicate = seqBefore(pkg.seq, peer.next) ||
+                     tracker.isProcessed(trackId, pkg.from);
+    if (!duplicate) {
+      if (tracker.size() >= tracker.getMaxMessages()) tracker.cleanup();
+      tracker.markProcessed(trackId, pkg.from);
+      if (pkg.seq == peer.next) {
+        ++peer.next;
+        while (peer.received.erase(peer.next) > 0) ++peer.next;
+      } else {
+        peer.received.insert(pkg.seq);
+        // Too much arrived after a gap, give up on it so the cumulative ack
+        // moves on, instead of staying behind the gap for good
+        while (peer.received.size() > 4 * RELIABLE_MAX_PENDING) {
+          auto oldest = peer.received.begin();
+          for (auto i = peer.received.begin(); i != peer.received.end(); ++i)
+            if (seqBefore(*i, *oldest)) oldest = i;
+          peer.next = *oldest + 1;
+          peer.received.erase(oldest);
+          while (peer.received.erase(peer.next) > 0) ++peer.next;
+          ++stats.skipped;
+        }
+      }
+      ++stats.received;
+    } else {
+      ++stats.duplicates;
+    }
+
+    ack.from = nodeId;
+    ack.dest = pkg.from;
+    ack.session = pkg.session;
+    ack.ack = peer.next;
+    ack.sack.clear();
+    // Always include this message, also if it only arrived out of order
+    if (!seqBefore(pkg.seq, peer.next)) ack.sack.push_back(pkg.seq);
+    for (auto&& seq : peer.received) {
+      if (ack.sack.size() >= RELIABLE_MAX_SACK) break;
+      if (seq != pkg.seq) ack.sack.push_back(seq);
+    }
+    ++stats.acksSent;
+    return !duplicate;
+  }
+
+  size_t size() const { return peers.size(); }
+
+  ReliableStats stats;
+
+ protected:
+  struct Peer {
+    uint32_t session = 0;
+    uint32_t next = 1;  // Next sequence number we expect
+    std::set<uint32_t> received;  // Received after a gap
+    uint32_t lastSeen = 0;
+  };
+
+  Peer& peerFor(uint32_t from, uint32_t now) {
+    auto it = peers.find(from);
+    if (it != peers.end()) return it->second;
+    if (peers.size() >= RELIABLE_MAX_PEERS) {
+      // Forget the sender we did not hear from for the longest time
+      auto oldest = peers.begin();
+      for (auto i = peers.begin(); i != peers.end(); ++i) {
+        if (now - i->second.lastSeen > now - oldest->second.lastSeen)
+          oldest = i;
+      }
+      peers.erase(oldest);
+    }
+    return peers[from];
+  }
+
+  std::map<uint32_t, Peer> peers;
+  MessageTracker tracker;
+};
+
+}  // namespace reliable
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_RELIABLE_HPP_
@@ -4,10 +4,14 @@
 #include <algorithm>
 #include <memory>
 
+#include "painlessmesh/aggregate.hpp"
 #include "painlessmesh/callback.hpp"
+#include "painlessmesh/flowcontrol.hpp"
+#include "painlessmesh/hoplimit.hpp"
 #include "painlessmesh/layout.hpp"
 #include "painlessmesh/logger.hpp"
 #include "painlessmesh/protocol.hpp"
+#include "painlessmesh/validation.hpp"
 
 extern painlessmesh::logger::LogClass Log;
 
@@ -163,15 +167,78 @@ size_t broadcast(T&& package, layout::Layout<U> layout, uint32_t exclude) {
   return i;
 }
 
+/**
+ * Queue a message on a connection, with a deadline (millis()) and coalescing
+ * key if it has them
+ */
+template <class U>
+bool queueMessage(std::shared_ptr<U> conn, const TSTRING& msg,
+                  uint32_t deadline, uint64_t key = 0) {
+  if (deadline == 0 && key == 0) return conn->addMessage(msg);
+  return conn->addMessageWithPriority(msg, 2, deadline, key);
+}
+
+/**
+ * Key used to coalesce queued messages, unique over the whole mesh
+ *
+ * Only messages of the same stream (sender, destination and routing) replace
+ * each other, so a single message with a key doesn't replace one with the
+ * same key to another node, or a broadcast.
+ *
+ * \return 0 if the package should not be coalesced
+ */
+inline uint64_t queueKey(uint32_t from, uint32_t dest, int routing,
+                         uint32_t key) {
+  if (key == 0) return 0;
+  if (routing == BROADCAST) dest = 0;
+  uint32_t stream = (dest ^ ((uint32_t)routing << 24)) * 0x9E3779B1u;
+  stream ^= stream >> 15;
+  return ((uint64_t)from << 32) | (key ^ stream);
+}
+
+/**
+ * Convert the deadline of a package (mesh time) to a local deadline
+ * (millis())
+ *
+ * \param deadline Set to the local deadline, or 0 if the package has none
+ *
+ * \return false if the deadline already passed
+ */
+inline bool localDeadline(protocol::Variant& variant, uint32_t meshTime,
+                          uint32_t& deadline) {
+  deadline = 0;
+  auto meshDeadline = variant.deadline();
+  if (meshDeadline == 0) return true;
+  auto remaining = (int32_t)(meshDeadline - meshTime);
+  if (remaining <= 0) return false;
+  deadline = millis() + remaining / 1000;
+  if (deadline == 0) deadline = 1;
+  return true;
+}
+
+/**
+ * Count the hops of a routed package and take one off its hop limit (see
+ * hoplimit.hpp)
+ *
+ * \return false if it has no hops left, so must not be forwarded
+ */
+inline bool takeHop(protocol::Variant& variant,
+                    hoplimit::HopLimits& hopLimits) {
+  auto left = hopLimits.received(variant.type(), variant.ttl());
+  if (left < 0) return false;
+  variant.ttl(left);
+  return true;
+}
+
 template <class T>
 size_t broadcast(protocol::Variant& variant, layout::Layout<T> layout,
-                 uint32_t exclude) {
+                 uint32_t exclude, uint32_t deadline = 0, uint64_t key = 0) {
   TSTRING msg;
   variant.printTo(msg);
   size_t i = 0;
   for (auto&& conn : layout.subs) {
     if (conn->nodeId != 0 && conn->nodeId != exclude) {
-      auto sent = conn->addMessage(msg);
+      auto sent = queueMessage(conn, msg, deadline, key);
       if (sent) ++i;
     }
   }
@@ -193,13 +260,235 @@ size_t broadcast(protocol::Variant&& variant, layout::Layout<T> layout,
   return i;
 }
 
+/**
+ * Broadcast a topic message, but only to neighbours with subscribers to the
+ * topic behind them
+ *
+ * \return Number of connections the message was send to
+ */
 template <class T>
-void routePackage(layout::Layout<T> layout, std::shared_ptr<T> connection,
-                  const TSTRING& pkg, callback::MeshPackageCallbackList<T> cbl,
+size_t broadcastTopic(protocol::Variant& variant, layout::Layout<T>& layout,
+                      uint32_t exclude, uint32_t deadline = 0,
+                      uint64_t key = 0) {
+  auto topic = variant.topic();
+  TSTRING msg;
+  size_t i = 0;
+  for (auto&& conn : layout.subs) {
+    if (conn->nodeId == 0 || conn->nodeId == exclude) continue;
+    if (!conn->wantsTopic(topic)) {
+      ++conn->suppressedTopicMessages;
+      continue;
+    }
+    if (msg.length() == 0) variant.printTo(msg);
+    if (queueMessage(conn, msg, deadline, key)) ++i;
+  }
+  return i;
+}
+
+/**
+ * Add the topics subscribed to on our side of the connection to a node sync
+ *
+ * That is our own topics, plus those advertised by our other neighbours. If
+ * any of those neighbours does not advertise its topics (older nodes), we
+ * can't know and leave them out, so the other side will send us everything.
+ */
+template <class T, class U>
+void advertiseTopics(T& mesh, std::shared_ptr<U> connection,
+                     protocol::NodeSyncRequest& request) {
+  request.topics = mesh.subscribedTopics;
+  request.hasTopics = true;
+  for (auto&& sub : mesh.subs) {
+    if (sub == connection || sub->nodeId == 0) continue;
+    if (!sub->topicsKnown) {
+      request.topics.clear();
+      request.hasTopics = false;
+      return;
+    }
+    request.topics.insert(request.topics.end(), sub->topics.begin(),
+                          sub->topics.end());
+  }
+  std::sort(request.topics.begin(), request.topics.end());
+  request.topics.erase(
+      std::unique(request.topics.begin(), request.topics.end()),
+      request.topics.end());
+}
+
+/**
+ * Store the topics advertised by a neighbour
+ *
+ * If they changed, what we advertise to our other neighbours changes as well,
+ * so sync with them.
+ */
+template <class T, class U>
+void handleTopics(T& mesh, std::shared_ptr<U> connection,
+                  protocol::NodeSyncRequest& request) {
+  std::sort(request.topics.begin(), request.topics.end());
+  if (connection->topicsKnown == request.hasTopics &&
+      connection->topics == request.topics)
+    return;
+  connection->topics = request.topics;
+  connection->topicsKnown = request.hasTopics;
+  for (auto&& sub : mesh.subs) {
+    if (sub != connection && sub->connected() && !sub->newConnection &&
+        sub->nodeId != 0)
+      sub->nodeSyncTask.forceNextIteration();
+  }
+}
+
+/**
+ * Hold a package for our next parent, if we are looking for one (see
+ * handover.hpp)
+ */
+template <class T, class M>
+bool holdUpstream(protocol::Variant& variant, M& mesh, uint32_t dest,
+                  uint32_t deadline) {
+  if (!mesh.handover.active()) return false;
+  TSTRING msg;
+  variant.printTo(msg);
+  return mesh.handover.hold(msg, dest, deadline);
+}
+
+/**
+ * Connection towards the nearest of the given gateways
+ *
+ * Ties are broken on the lowest node id, so nodes agree on the gateway.
+ *
+ * \param exclude Connection not to use (the one the package came in on)
+ * \param gatewayId Set to the chosen gateway
+ */
+template <class T>
+std::shared_ptr<T> nearestGateway(layout::Layout<T>& layout,
+                                  const std::vector<uint32_t>& gateways,
+                                  std::shared_ptr<T> exclude,
+                                  uint32_t& gatewayId) {
+  std::shared_ptr<T> best;
+  int bestHops = -1;
+  gatewayId = 0;
+  for (auto&& conn : layout.subs) {
+    if (conn == exclude || conn->nodeId == 0 || !conn->connected()) continue;
+    for (auto&& id : gateways) {
+      auto hops = layout::depthOf((*conn), id);
+      if (hops < 0) continue;
+      if (bestHops < 0 || hops < bestHops ||
+          (hops == bestHops && id < gatewayId)) {
+        best = conn;
+        bestHops = hops;
+        gatewayId = id;
+      }
+    }
+  }
+  return best;
+}
+
+/**
+ * Merge an aggregate package on its way to the sink into our own aggregates,
+ * instead of forwarding it
+ *
+ * \return Whether the package was merged
+ */
+template <class T, class M>
+bool absorbAggregate(protocol::Variant& variant, M& mesh) {
+  if (!mesh.aggregator || variant.dest() != mesh.aggregator->sink())
+    return false;
+  auto pkg = variant.to<aggregate::AggregatePackage>();
+  return mesh.aggregator->absorb(pkg);
+}
+
+/**
+ * Send a package for protocol::ANY_GATEWAY on towards the nearest healthy
+ * gateway
+ *
+ * The destination stays ANY_GATEWAY, so the next router resolves it again
+ * with its own (more recent) view of the mesh. The incoming connection is
+ * never used, which keeps two routers with different views from sending the
+ * package back and forth.
+ */
+template <class T, class M>
+bool forwardAnycast(protocol::Variant& variant, M& mesh,
+                    std::shared_ptr<T> connection, uint32_t deadline = 0,
+                    uint64_t key = 0) {
+  auto& directory = mesh.gatewayDirectory;
+  uint32_t gatewayId = 0;
+  auto conn = nearestGateway<T>(mesh, directory.gateways(millis()),
+                                connection, gatewayId);
+  if (!conn) {
+    ++directory.stats.unresolved;
+    Log(logger::COMMUNICATION,
+        "forwardAnycast(): No gateway reachable, dropping package from %u\n",
+        variant.from());
+    return false;
+  }
+  TSTRING msg;
+  variant.printTo(msg);
+  ++directory.stats.forwarded;
+  return queueMessage(conn, msg, deadline, key);
+}
+
+/**
+ * Forward a single message that is not for us
+ *
+ * If the queue towards the destination is filling up, the original sender
+ * gets credit feedback (see flowcontrol.hpp), at most once per
+ * FLOW_CONTROL_FEEDBACK_INTERVAL per incoming connection.
+ */
+template <class T, class M>
+bool forward(protocol::Variant& variant, M& mesh, std::shared_ptr<T> connection,
+             uint32_t deadline = 0, uint64_t key = 0) {
+  auto conn = findRoute<T>(mesh, variant.dest());
+  // Without parent the destination is most likely upstream
+  if (!conn) return holdUpstream<T>(variant, mesh, variant.dest(), deadline);
+  TSTRING msg;
+  variant.printTo(msg);
+  auto sent = queueMessage(conn, msg, deadline, key);
+
+  auto queue = conn->queueSize();
+  if (queue < FLOW_CONTROL_THRESHOLD || !connection ||
+      !flowcontrol::isFlowControlled(variant.type()))
+    return sent;
+  auto now = millis();
+  if (connection->flowFeedbackSent &&
+      now - connection->lastFlowFeedback < FLOW_CONTROL_FEEDBACK_INTERVAL)
+    return sent;
+  connection->flowFeedbackSent = true;
+  connection->lastFlowFeedback = now;
+
+  flowcontrol::CreditPackage credit;
+  credit.from = mesh.getNodeId();
+  credit.dest = variant.from();
+  credit.node = variant.dest();
+  credit.queue = queue;
+  credit.window = flowcontrol::suggestedWindow(queue);
+  Log(logger::COMMUNICATION,
+      "forward(): queue to %u is %u, asking %u to slow down to %u\n",
+      conn->nodeId, queue, credit.dest, credit.window);
+  // The incoming connection is the route back to the sender
+  protocol::Variant feedback(&credit);
+  send(feedback, connection, true);
+  return sent;
+}
+
+/**
+ * Handle a message received on connection
+ *
+ * The mesh is passed by reference, as routing uses and updates its state
+ * (handover buffer, gateway directory, hop and rate limits, aggregation).
+ */
+template <class T, class M>
+void routePackage(M& mesh, std::shared_ptr<T> connection, const TSTRING& pkg,
+                  callback::MeshPackageCallbackList<T> cbl,
                   uint32_t receivedAt) {
   using namespace logger;
   Log(COMMUNICATION, "routePackage(): Recvd from %u: %s\n", connection->nodeId,
       pkg.c_str());
+  // Reject garbage before anything is allocated for it
+  auto valid = validation::scanMessage(pkg.c_str(), pkg.length(),
+                                       mesh.validationConfig);
+  if (valid != validation::ValidationResult::VALID) {
+    connection->rejectedMessages.count(valid);
+    Log(ERROR, "routePackage(): Rejected message from %u, reason=%d length=%u\n",
+        connection->nodeId, (int)valid, pkg.length());
+    return;
+  }
 #if ARDUINOJSON_VERSION_MAJOR == 7
   protocol::Variant variant(pkg);
   if (variant.error) {
@@ -209,12 +498,63 @@ void routePackage(layout::Layout<T> layout, std::shared_ptr<T> connection,
     return;
   }
 
-  if (variant.routing() == SINGLE && variant.dest() != layout.getNodeId()) {
-    // Send on without further processing
-    send<T>(variant, layout);
+  // Drop messages that expired on the way, keep the deadline while queued
+  uint32_t deadline = 0;
+  if (!localDeadline(variant, receivedAt, deadline)) {
+    ++connection->expiredMessages;
+    Log(COMMUNICATION, "routePackage(): Dropped expired package from %u\n",
+        variant.from());
+    return;
+  }
+
+  // Drop floods from a single origin before they reach every link
+  if (mesh.rateLimiter &&
+      !mesh.rateLimiter->allow(variant.from(), variant.type(), millis())) {
+    connection->rejectedMessages.count(
+        validation::ValidationResult::RATE_LIMIT_EXCEEDED);
+    Log(COMMUNICATION, "routePackage(): %u is over its rate limit for %d\n",
+        variant.from(), variant.type());
+    return;
+  }
+
+  // Newer messages with the same key replace queued ones
+  auto key = queueKey(variant.from(), variant.dest(), variant.routing(),
+                      variant.coalesceKey());
+
+  // Packages without hops left are still handled, but not send on
+  bool canForward = true;
+  if (variant.routing() == SINGLE || variant.routing() == BROADCAST)
+    canForward = takeHop(variant, mesh.hopLimits);
+
+  if (variant.routing() == SINGLE && variant.dest() == protocol::ANY_GATEWAY) {
+    if (!mesh.gatewayDirectory.isGateway(mesh.getNodeId(), millis())) {
+      if (canForward)
+        forwardAnycast<T>(variant, mesh, connection, deadline, key);
+      else
+        ++mesh.hopLimits.stats.exhausted;
+      return;
+    }
+    // We are a gateway, handle it here
+    ++mesh.gatewayDirectory.stats.delivered;
+  } else if (variant.routing() == SINGLE &&
+             variant.dest() != mesh.getNodeId()) {
+    // Send on without further processing, unless we can aggregate it
+    if (variant.type() == protocol::AGGREGATE &&
+        absorbAggregate<T>(variant, mesh))
+      return;
+    if (canForward)
+      forward<T>(variant, mesh, connection, deadline, key);
+    else
+      ++mesh.hopLimits.stats.exhausted;
     return;
+  } else if (variant.routing() == BROADCAST && !canForward) {
+    ++mesh.hopLimits.stats.exhausted;
   } else if (variant.routing() == BROADCAST) {
-    broadcast<T>(variant, layout, connection->nodeId);
+    if (variant.type() == protocol::PUBLISH)
+      broadcastTopic<T>(variant, mesh, connection->nodeId, deadline, key);
+    else
+      broadcast<T>(variant, mesh, connection->nodeId, deadline, key);
+    holdUpstream<T>(variant, mesh, 0, deadline);
   }
   auto calls = cbl.execute(variant.type(), variant, connection, receivedAt);
   if (calls == 0)
@@ -260,12 +600,64 @@ void routePackage(layout::Layout<T> layout, std::shared_ptr<T> connection,
     return;
   }
 
-  if (variant->routing() == SINGLE && variant->dest() != layout.getNodeId()) {
-    // Send on without further processing
-    send<T>((*variant), layout);
+  // Drop messages that expired on the way, keep the deadline while queued
+  uint32_t deadline = 0;
+  if (!localDeadline((*variant), receivedAt, deadline)) {
+    ++connection->expiredMessages;
+    Log(COMMUNICATION, "routePackage(): Dropped expired package from %u\n",
+        variant->from());
+    return;
+  }
+
+  // Drop floods from a single origin before they reach every link
+  if (mesh.rateLimiter &&
+      !mesh.rateLimiter->allow(variant->from(), variant->type(), millis())) {
+    connection->rejectedMessages.count(
+        validation::ValidationResult::RATE_LIMIT_EXCEEDED);
+    Log(COMMUNICATION, "routePackage(): %u is over its rate limit for %d\n",
+        variant->from(), variant->type());
+    return;
+  }
+
+  // Newer messages with the same key replace queued ones
+  auto key = queueKey(variant->from(), variant->dest(), variant->routing(),
+                      variant->coalesceKey());
+
+  // Packages without hops left are still handled, but not send on
+  bool canForward = true;
+  if (variant->routing() == SINGLE || variant->routing() == BROADCAST)
+    canForward = takeHop((*variant), mesh.hopLimits);
+
+  if (variant->routing() == SINGLE &&
+      variant->dest() == protocol::ANY_GATEWAY) {
+    if (!mesh.gatewayDirectory.isGateway(mesh.getNodeId(), millis())) {
+      if (canForward)
+        forwardAnycast<T>((*variant), mesh, connection, deadline, key);
+      else
+        ++mesh.hopLimits.stats.exhausted;
+      return;
+    }
+    // We are a gateway, handle it here
+    ++mesh.gatewayDirectory.stats.delivered;
+  } else if (variant->routing() == SINGLE &&
+             variant->dest() != mesh.getNodeId()) {
+    // Send on without further processing, unless we can aggregate it
+    if (variant->type() == protocol::AGGREGATE &&
+        absorbAggregate<T>((*variant), mesh))
+      return;
+    if (canForward)
+      forward<T>((*variant), mesh, connection, deadline, key);
+    else
+      ++mesh.hopLimits.stats.exhausted;
     return;
+  } else if (variant->routing() == BROADCAST && !canForward) {
+    ++mesh.hopLimits.stats.exhausted;
   } else if (variant->routing() == BROADCAST) {
-    broadcast<T>((*variant), layout, connection->nodeId);
+    if (variant->type() == protocol::PUBLISH)
+      broadcastTopic<T>((*variant), mesh, connection->nodeId, deadline, key);
+    else
+      broadcast<T>((*variant), mesh, connection->nodeId, deadline, key);
+    holdUpstream<T>((*variant), mesh, 0, deadline);
   }
   auto calls = cbl.execute(variant->type(), (*variant), connection, receivedAt);
   if (calls == 0)
@@ -343,9 +735,11 @@ callback::MeshPackageCallbackList<U> addPackageCallback(
       [&mesh](protocol::Variant& variant, std::shared_ptr<U> connection,
               uint32_t receivedAt) {
         auto newTree = variant.to<protocol::NodeSyncRequest>();
+        handleTopics<T, U>(mesh, connection, newTree);
         handleNodeSync<T, U>(mesh, newTree, connection);
-        send<protocol::NodeSyncReply>(
-            connection->reply(std::move(mesh.asNodeTree())), connection, true);
+        auto reply = connection->reply(std::move(mesh.asNodeTree()));
+        advertiseTopics<T, U>(mesh, connection, reply);
+        send<protocol::NodeSyncReply>(reply, connection, true);
         return false;
       });
 
@@ -355,6 +749,7 @@ callback::MeshPackageCallbackList<U> addPackageCallback(
       [&mesh](protocol::Variant& variant, std::shared_ptr<U> connection,
               uint32_t receivedAt) {
         auto newTree = variant.to<protocol::NodeSyncReply>();
+        handleTopics<T, U>(mesh, connection, newTree);
         handleNodeSync<T, U>(mesh, newTree, connection);
         connection->timeOutTask.disable();
         return false;
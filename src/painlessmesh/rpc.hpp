@@ -0,0 +1,299 @@
+#ifndef _PAINLESS_MESH_RPC_HPP_
+#define _PAINLESS_MESH_RPC_HPP_
+
+/**
+ * @file rpc.hpp
+ * @brief Request/response calls between nodes
+ *
+ * Sketches that send a command to a node and wait for its answer all need to
+ * match answers to requests, time out requests that are never answered and
+ * limit how many are outstanding. Mesh::call() does this once:
+ *
+ * - Nodes register methods by name with Mesh::registerMethod().
+ * - A call sends a request with a call id to the destination, which runs the
+ *   method and sends the result back with the same id.
+ * - The result (or the time out) is handed to the callback of the call.
+ *
+ * Calls are pipelined: up to RPC_MAX_PENDING calls to the same node can be
+ * outstanding at the same time, and results are matched by id in whatever
+ * order they arrive. Time outs are kept in a heap ordered by deadline, so
+ * checking them only looks at the calls that are due.
+ */
+
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/plugin.hpp"
+#include "painlessmesh/protocol.hpp"
+#include "painlessmesh/validation.hpp"
+
+#ifndef RPC_MAX_PENDING
+#define RPC_MAX_PENDING 16  // Outstanding calls per destination
+#endif
+#ifndef RPC_DEFAULT_TIMEOUT
+#define RPC_DEFAULT_TIMEOUT 5000  // ms
+#endif
+#ifndef RPC_TICK
+#define RPC_TICK 50  // ms between time out checks
+#endif
+
+namespace painlessmesh {
+namespace rpc {
+
+/**
+ * Result status of a call
+ *
+ * Methods return OK or FAILED (or their own codes above USER). TIMEOUT and
+ * NOT_SENT are only reported locally.
+ */
+enum Status {
+  OK = 0,
+  UNKNOWN_METHOD = 1,  // The destination has no such method
+  FAILED = 2,          // The method failed, see the result for details
+  TIMEOUT = 3,         // No result within the time out
+  NOT_SENT = 4,        // Too many pending calls, or the call could not be send
+  USER = 16            // First status code for application use
+};
+
+/**
+ * Method handler, sets result and returns a Status
+ */
+typedef std::function<int(uint32_t from, const TSTRING& params,
+                          TSTRING& result)>
+    methodHandler_t;
+
+/**
+ * Called with the result of a call
+ */
+typedef std::function<void(int status, const TSTRING& result)>
+    resultCallback_t;
+
+/**
+ * Call of a method
+ *
+ * Type ID: 680 (RPC_REQUEST)
+ * Base class: SinglePackage
+ */
+class RequestPackage : public plugin::SinglePackage {
+ public:
+  uint32_t id = 0;
+  TSTRING method = "";
+  TSTRING params = "";
+
+  static constexpr int numPackageFields = 3;
+
+  RequestPackage() : SinglePackage(protocol::RPC_REQUEST) {}
+
+  RequestPackage(JsonObject jsonObj) : SinglePackage(jsonObj) {
+    id = jsonObj["id"];
+    method = jsonObj["m"].as<TSTRING>();
+    params = jsonObj["p"].as<TSTRING>();
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = SinglePackage::addTo(std::move(jsonObj));
+    jsonObj["id"] = id;
+    jsonObj["m"] = method;
+    if (params.length() > 0) jsonObj["p"] = params;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields) +
+           method.length() + ceil(1.1 * params.length());
+  }
+#endif
+};
+
+/**
+ * Result of a call
+ *
+ * Type ID: 681 (RPC_RESPONSE)
+ * Base class: SinglePackage
+ */
+class ResponsePackage : public plugin::SinglePackage {
+ public:
+  uint32_t id = 0;  // Id of the call
+  int status = OK;
+  TSTRING result = "";
+
+  static constexpr int numPackageFields = 3;
+
+  ResponsePackage() : SinglePackage(protocol::RPC_RESPONSE) {}
+
+  ResponsePackage(JsonObject jsonObj) : SinglePackage(jsonObj) {
+    id = jsonObj["id"];
+    status = jsonObj["st"] | (int)OK;
+    result = jsonObj["r"].as<TSTRING>();
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = SinglePackage::addTo(std::move(jsonObj));
+    jsonObj["id"] = id;
+    if (status != OK) jsonObj["st"] = status;
+    if (result.length() > 0) jsonObj["r"] = result;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields) +
+           ceil(1.1 * result.length());
+  }
+#endif
+};
+
+/**
+ * Call statistics, see Mesh::getRpcStats()
+ */
+struct RpcStats {
+  uint32_t calls = 0;      // Calls send
+  uint32_t completed = 0;  // Calls that got a result (of any status)
+  uint32_t timedOut = 0;   // Calls without result within their time out
+  uint32_t refused = 0;    // Calls not send, RPC_MAX_PENDING were outstanding
+  uint32_t late = 0;       // Results that arrived after their time out
+  uint32_t served = 0;     // Calls of our methods
+  uint32_t unknown = 0;    // Calls of methods we don't have
+};
+
+/**
+ * Outstanding calls and their time outs
+ *
+ * Does not send anything itself; the mesh sends the requests and passes
+ * results and the time on.
+ */
+class CallTable {
+ public:
+  CallTable() : nextId(validation::SecureRandom::generate() | 1) {}
+
+  /**
+   * Register a new call to destId
+   *
+   * \return The id of the call, 0 if RPC_MAX_PENDING calls to destId are
+   * already outstanding
+   */
+  uint32_t add(uint32_t destId, resultCallback_t callback, uint32_t deadline) {
+    auto& outstanding = perDestination[destId];
+    if (outstanding >= RPC_MAX_PENDING) {
+      ++stats.refused;
+      return 0;
+    }
+    auto id = nextId++;
+    if (nextId == 0) nextId = 1;
+    Call call;
+    call.dest = destId;
+    call.deadline = deadline;
+    call.callback = callback;
+    calls[id] = call;
+    ++outstanding;
+    timers.push(std::make_pair(deadline, id));
+    ++stats.calls;
+    return id;
+  }
+
+  /**
+   * Forget a call without calling its callback, e.g. when sending it failed
+   */
+  void cancel(uint32_t id) {
+    auto it = calls.find(id);
+    if (it == calls.end()) return;
+    release(it->second.dest);
+    calls.erase(it);
+    --stats.calls;
+  }
+
+  /**
+   * Pass on the result of a call
+   *
+   * \return false if the call is unknown, e.g. because it timed out
+   */
+  bool complete(const ResponsePackage& pkg) {
+    auto it = calls.find(pkg.id);
+    if (it == calls.end() || it->second.dest != pkg.from) {
+      ++stats.late;
+      return false;
+    }
+    auto callback = it->second.callback;
+    release(it->second.dest);
+    calls.erase(it);
+    ++stats.completed;
+    // The callback can make new calls
+    if (callback) callback(pkg.status, pkg.result);
+    return true;
+  }
+
+  /**
+   * Time out the calls whose deadline passed
+   */
+  void expire(uint32_t now) {
+    while (!timers.empty() && (int32_t)(now - timers.top().first) >= 0) {
+      auto id = timers.top().second;
+      timers.pop();
+      auto it = calls.find(id);
+      // Completed calls leave their timer behind
+      if (it == calls.end()) continue;
+      auto callback = it->second.callback;
+      release(it->second.dest);
+      calls.erase(it);
+      ++stats.timedOut;
+      if (callback) callback(TIMEOUT, TSTRING());
+    }
+    // Don't let timers of completed calls pile up when results are fast
+    if (timers.size() > 2 * calls.size() + RPC_MAX_PENDING) rebuildTimers();
+  }
+
+  /// Calls that are outstanding
+  size_t pending() const { return calls.size(); }
+
+  /// Calls to destId that are outstanding
+  size_t pending(uint32_t destId) const {
+    auto it = perDestination.find(destId);
+    return it == perDestination.end() ? 0 : it->second;
+  }
+
+  RpcStats stats;
+
+ protected:
+  struct Call {
+    uint32_t dest = 0;
+    uint32_t deadline = 0;
+    resultCallback_t callback;
+  };
+
+  typedef std::pair<uint32_t, uint32_t> Timer;  // deadline, id
+
+  // Earliest deadline on top of the heap, handles millis() roll over
+  struct Later {
+    bool operator()(const Timer& a, const Timer& b) const {
+      return (int32_t)(a.first - b.first) > 0;
+    }
+  };
+
+  void release(uint32_t destId) {
+    auto it = perDestination.find(destId);
+    if (it == perDestination.end()) return;
+    if (--it->second == 0) perDestination.erase(it);
+  }
+
+  void rebuildTimers() {
+    std::priority_queue<Timer, std::vector<Timer>, Later> active;
+    for (auto&& call : calls)
+      active.push(std::make_pair(call.second.deadline, call.first));
+    std::swap(timers, active);
+  }
+
+  uint32_t nextId;
+  std::map<uint32_t, Call> calls;
+  std::map<uint32_t, uint16_t> perDestination;
+  std::priority_queue<Timer, std::vector<Timer>, Later> timers;
+};
+
+}  // namespace rpc
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_RPC_HPP_
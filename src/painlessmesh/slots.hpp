@@ -0,0 +1,174 @@
+#ifndef _PAINLESS_MESH_SLOTS_HPP_
+#define _PAINLESS_MESH_SLOTS_HPP_
+
+/**
+ * @file slots.hpp
+ * @brief Transmission slots based on the synchronised mesh time
+ *
+ * Periodic traffic (e.g. telemetry) tends to be sent by all nodes at the same
+ * moment, which causes collisions and long queues near the root. Because the
+ * mesh time is kept in sync, nodes can instead divide each period into a
+ * number of slots and only start their periodic transmissions at the start of
+ * their own slot.
+ *
+ * By default a node derives its slot from its node id. The root node can
+ * instead hand out slots, which avoids two nodes sharing a slot as long as
+ * there are more slots than nodes. The root repeats all assignments every
+ * TRANSMIT_SLOT_REFRESH, so a node whose assignment got lost gets it later.
+ */
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+#include "painlessmesh/plugin.hpp"
+#include "painlessmesh/protocol.hpp"
+
+#ifndef TRANSMIT_SLOT_COUNT
+#define TRANSMIT_SLOT_COUNT 16  // Default number of slots per period
+#endif
+#ifndef TRANSMIT_SLOT_REFRESH
+#define TRANSMIT_SLOT_REFRESH 60000  // ms between repeated slot assignments
+#endif
+
+namespace painlessmesh {
+namespace slots {
+
+/**
+ * Slot used by a node until it gets one assigned by the root
+ */
+inline uint16_t defaultSlot(uint32_t nodeId, uint16_t slotCount) {
+  if (slotCount == 0) return 0;
+  // Node ids of one production batch are often close together, so mix the
+  // bits to spread them over the slots
+  uint32_t h = nodeId;
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return h % slotCount;
+}
+
+/**
+ * Time until the start of the next slot (ms)
+ *
+ * \param meshTime Current (64 bit) mesh time in microseconds
+ * \param periodMs Length of the period that is divided in slots
+ * \param slot The slot we want to transmit in
+ * \param slotCount Number of slots per period
+ *
+ * \return 0 if the slot starts right now
+ */
+inline uint32_t timeToNextSlot(uint64_t meshTime, uint32_t periodMs,
+                               uint16_t slot, uint16_t slotCount) {
+  if (periodMs == 0 || slotCount == 0) return 0;
+  uint64_t period = (uint64_t)periodMs * 1000;
+  uint64_t offset = period * (slot % slotCount) / slotCount;
+  uint64_t wait = (offset + period - meshTime % period) % period;
+  return (uint32_t)((wait + 999) / 1000);
+}
+
+/**
+ * Slot assignment, send by the root to the individual nodes
+ *
+ * Type ID: 630 (TRANSMIT_SLOT)
+ * Base class: SinglePackage
+ */
+class SlotAssignmentPackage : public plugin::SinglePackage {
+ public:
+  uint16_t slot = 0;
+  uint16_t slotCount = TRANSMIT_SLOT_COUNT;
+
+  static constexpr int numPackageFields = 2;
+
+  SlotAssignmentPackage() : SinglePackage(protocol::TRANSMIT_SLOT) {}
+
+  SlotAssignmentPackage(JsonObject jsonObj) : SinglePackage(jsonObj) {
+    slot = jsonObj["slot"];
+    slotCount = jsonObj["slots"] | TRANSMIT_SLOT_COUNT;
+  }
+
+  JsonObject addTo(JsonObject&& jsonObj) const {
+    jsonObj = SinglePackage::addTo(std::move(jsonObj));
+    jsonObj["slot"] = slot;
+    jsonObj["slots"] = slotCount;
+    return jsonObj;
+  }
+
+#if ARDUINOJSON_VERSION_MAJOR < 7
+  size_t jsonObjectSize() const {
+    return JSON_OBJECT_SIZE(noJsonFields + numPackageFields);
+  }
+#endif
+};
+
+/**
+ * Keeps track of the slots handed out by the root
+ *
+ * Nodes keep their slot as long as they are part of the mesh. New nodes get
+ * the least used slot, so slots are only shared once all of them are in use.
+ */
+class SlotAssigner {
+ public:
+  /**
+   * Update the assignments to the current list of nodes
+   *
+   * \return The nodes whose slot is new or changed, and need to be informed
+   */
+  std::list<std::pair<uint32_t, uint16_t>> update(
+      const std::list<uint32_t>& nodes, uint16_t slotCount) {
+    std::list<std::pair<uint32_t, uint16_t>> changed;
+    if (slotCount == 0) return changed;
+    if (slotCount != assignedCount) {
+      assigned.clear();
+      assignedCount = slotCount;
+    }
+
+    // Forget about nodes that left the mesh
+    std::map<uint32_t, uint16_t> current;
+    std::vector<uint16_t> usage(slotCount, 0);
+    for (auto&& nodeId : nodes) {
+      auto it = assigned.find(nodeId);
+      if (it == assigned.end()) continue;
+      current.insert(*it);
+      ++usage[it->second];
+    }
+    assigned = current;
+
+    for (auto&& nodeId : nodes) {
+      if (assigned.count(nodeId)) continue;
+      // Start looking at the default slot, so the assignment matches what the
+      // node is using already if possible
+      auto start = defaultSlot(nodeId, slotCount);
+      auto best = start;
+      for (uint16_t i = 1; i < slotCount; ++i) {
+        auto slot = (start + i) % slotCount;
+        if (usage[slot] < usage[best]) best = slot;
+      }
+      ++usage[best];
+      assigned[nodeId] = best;
+      changed.push_back(std::make_pair(nodeId, best));
+    }
+    return changed;
+  }
+
+  void clear() {
+    assigned.clear();
+    assignedCount = 0;
+  }
+
+  size_t size() const { return assigned.size(); }
+
+  /// Current slot of every node
+  const std::map<uint32_t, uint16_t>& assignments() const { return assigned; }
+
+ protected:
+  std::map<uint32_t, uint16_t> assigned;
+  uint16_t assignedCount = 0;
+};
+
+}  // namespace slots
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_SLOTS_HPP_
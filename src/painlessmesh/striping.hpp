@@ -0,0 +1,238 @@
+#ifndef _PAINLESS_MESH_STRIPING_HPP_
+#define _PAINLESS_MESH_STRIPING_HPP_
+
+/**
+ * @file striping.hpp
+ * @brief Spread Internet requests over all healthy bridges
+ *
+ * Normally a node sends all its Internet requests to a single bridge, so bulk
+ * uploads are limited to the uplink of that one bridge. With striping enabled
+ * (see Mesh::enableUplinkStriping()) every request goes to the next healthy
+ * bridge in a smooth weighted round robin. The weight is the capacity a
+ * bridge advertises in its status, or is derived from its router signal if it
+ * doesn't. Each bridge has at most a few requests in flight, further requests
+ * wait for one of them to finish.
+ *
+ * Striped requests carry a sequence number per origin, because they can
+ * reach the destination out of order. Destinations that care about order can
+ * use ReorderBuffer (or the X-Mesh-Sequence header the gateway adds) to put
+ * them back in order.
+ */
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "painlessmesh/configuration.hpp"
+
+#ifndef STRIPE_MAX_IN_FLIGHT
+#define STRIPE_MAX_IN_FLIGHT 4  // Unacknowledged requests per bridge
+#endif
+#ifndef STRIPE_REORDER_WINDOW
+#define STRIPE_REORDER_WINDOW 16  // Messages held back waiting for a gap
+#endif
+
+namespace painlessmesh {
+namespace striping {
+
+/**
+ * Striping statistics, see Mesh::getStripeStats()
+ */
+struct StripeStats {
+  uint32_t striped = 0;   // Requests assigned to a bridge
+  uint32_t deferred = 0;  // Requests that waited because all bridges were busy
+  size_t bridges = 0;     // Healthy bridges requests are striped over
+  size_t backlog = 0;     // Requests currently waiting
+};
+
+/**
+ * Relative weight of a bridge
+ *
+ * \param capacity Capacity advertised by the bridge, 0 if none
+ * \param routerRSSI Signal of the bridge to its router, used without capacity
+ */
+inline uint16_t capacityWeight(uint8_t capacity, int8_t routerRSSI) {
+  if (capacity > 0) return capacity;
+  // -30 dBm or better counts as 70, -90 dBm or worse as 10
+  int weight = (int)routerRSSI + 100;
+  if (routerRSSI == 0 || weight > 70) weight = 70;
+  if (weight < 10) weight = 10;
+  return weight;
+}
+
+/**
+ * A bridge requests can be striped over
+ */
+struct StripeCandidate {
+  uint32_t nodeId = 0;
+  uint16_t weight = 1;
+  uint16_t inFlight = 0;  // Requests sent to it that are not finished yet
+};
+
+/**
+ * Smooth weighted round robin over the bridges
+ *
+ * Over time each bridge gets a share of the requests proportional to its
+ * weight, interleaved instead of in bursts. Bridges with inFlightLimit
+ * requests in flight are skipped.
+ */
+class StripeScheduler {
+ public:
+  /**
+   * Pick the bridge for the next request
+   *
+   * \return The bridge, 0 if there is none or all of them are busy
+   */
+  uint32_t pick(const std::vector<StripeCandidate>& candidates) {
+    forgetOthers(candidates);
+    int32_t total = 0;
+    const StripeCandidate* best = nullptr;
+    for (auto&& candidate : candidates) {
+      if (candidate.inFlight >= inFlightLimit) continue;
+      auto& current = this->current[candidate.nodeId];
+      current += candidate.weight;
+      total += candidate.weight;
+      if (best == nullptr || current > this->current[best->nodeId])
+        best = &candidate;
+    }
+    if (best == nullptr) return 0;
+    this->current[best->nodeId] -= total;
+    ++stats.striped;
+    return best->nodeId;
+  }
+
+  /**
+   * Whether there are bridges, but all of them are busy
+   */
+  bool busy(const std::vector<StripeCandidate>& candidates) const {
+    if (candidates.empty()) return false;
+    for (auto&& candidate : candidates) {
+      if (candidate.inFlight < inFlightLimit) return false;
+    }
+    return true;
+  }
+
+  uint16_t inFlightLimit = STRIPE_MAX_IN_FLIGHT;
+
+  StripeStats stats;
+
+ protected:
+  void forgetOthers(const std::vector<StripeCandidate>& candidates) {
+    for (auto it = current.begin(); it != current.end();) {
+      bool found = false;
+      for (auto&& candidate : candidates) {
+        if (candidate.nodeId == it->first) {
+          found = true;
+          break;
+        }
+      }
+      if (found)
+        ++it;
+      else
+        it = current.erase(it);
+    }
+  }
+
+  std::map<uint32_t, int32_t> current;
+};
+
+/**
+ * Reordering statistics, see ReorderBuffer
+ */
+struct ReorderStats {
+  uint32_t inOrder = 0;    // Messages that arrived in order
+  uint32_t reordered = 0;  // Messages held back until the gap before them closed
+  uint32_t skipped = 0;    // Gaps given up on because the window was full
+  uint32_t late = 0;       // Messages that arrived after their gap was skipped
+};
+
+/**
+ * Puts striped messages from each origin back in sequence order
+ *
+ * Messages after a gap are held back until the gap closes. When more than
+ * STRIPE_REORDER_WINDOW messages are held the gap is given up on, so a lost
+ * message doesn't block the ones after it forever. Messages that arrive after
+ * their gap was given up on are passed on right away.
+ */
+class ReorderBuffer {
+ public:
+  /**
+   * Add a message
+   *
+   * \return The messages that can be delivered now, in order
+   */
+  std::list<TSTRING> push(uint32_t origin, uint32_t sequence,
+                          const TSTRING& msg) {
+    std::list<TSTRING> ready;
+    auto found = origins.find(origin);
+    if (found == origins.end()) {
+      // First message from this origin, start counting from here
+      found = origins.insert(std::make_pair(origin, Origin())).first;
+      found->second.next = sequence;
+    }
+    auto& state = found->second;
+    if ((int32_t)(sequence - state.next) < 0) {
+      ++stats.late;
+      ready.push_back(msg);
+      return ready;
+    }
+    if (sequence == state.next)
+      ++stats.inOrder;
+    else
+      ++stats.reordered;
+    state.held[sequence] = msg;
+    release(state, ready);
+    while (state.held.size() > STRIPE_REORDER_WINDOW) {
+      ++stats.skipped;
+      state.next = state.held.begin()->first;
+      release(state, ready);
+    }
+    return ready;
+  }
+
+  /**
+   * Give up on all gaps of an origin
+   *
+   * \return The messages that were held back, in order
+   */
+  std::list<TSTRING> flush(uint32_t origin) {
+    std::list<TSTRING> ready;
+    auto found = origins.find(origin);
+    if (found == origins.end()) return ready;
+    for (auto&& held : found->second.held) ready.push_back(held.second);
+    origins.erase(found);
+    return ready;
+  }
+
+  /// Messages held back, over all origins
+  size_t size() const {
+    size_t count = 0;
+    for (auto&& origin : origins) count += origin.second.held.size();
+    return count;
+  }
+
+  ReorderStats stats;
+
+ protected:
+  struct Origin {
+    uint32_t next = 0;
+    std::map<uint32_t, TSTRING> held;
+  };
+
+  void release(Origin& state, std::list<TSTRING>& ready) {
+    auto it = state.held.begin();
+    while (it != state.held.end() && it->first == state.next) {
+      ready.push_back(it->second);
+      it = state.held.erase(it);
+      ++state.next;
+    }
+  }
+
+  std::map<uint32_t, Origin> origins;
+};
+
+}  // namespace striping
+}  // namespace painlessmesh
+
+#endif  // _PAINLESS_MESH_STRIPING_HPP_
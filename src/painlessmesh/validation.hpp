@@ -8,6 +8,8 @@
  * security and robustness of the mesh network.
  */
 
+#include <string.h>
+
 #ifndef ARDUINO
 #include <chrono>
 #endif
@@ -27,7 +29,9 @@ enum class ValidationResult {
   INVALID_FIELD_VALUE,
   MESSAGE_TOO_LARGE,
   INVALID_NODE_ID,
-  RATE_LIMIT_EXCEEDED
+  RATE_LIMIT_EXCEEDED,
+  NESTING_TOO_DEEP,
+  STRING_TOO_LONG
 };
 
 /**
@@ -42,6 +46,154 @@ struct ValidationConfig {
   bool strict_type_checking = true;   // Enable strict type validation
 };
 
+/**
+ * Limits the router checks every received message against
+ *
+ * Strings may be as long as the message itself, because OTA data parts are
+ * base64 strings longer than the default max_string_length. Node syncs nest
+ * two levels per hop, so the nesting depth allows for trees 31 hops deep.
+ */
+inline ValidationConfig routerConfig() {
+  ValidationConfig config;
+  config.max_string_length = config.max_message_size;
+  config.max_nesting_depth = 64;
+  return config;
+}
+
+/**
+ * Check a raw message before it is parsed
+ *
+ * A single pass over the bytes, without allocating anything, that rejects
+ * messages that are too large, are not a JSON object, nest too deep, contain
+ * too long strings or whose top level "from" is not a valid node id. Anything
+ * that passes still has to be parsed, this only keeps obvious garbage away
+ * from the parser.
+ */
+inline ValidationResult scanMessage(const char* data, size_t length,
+                                    const ValidationConfig& config) {
+  if (length > config.max_message_size)
+    return ValidationResult::MESSAGE_TOO_LARGE;
+  size_t depth = 0;
+  bool started = false;
+  bool inString = false;
+  bool escaped = false;
+  size_t stringStart = 0;
+  bool fromKey = false;   // Last top level key was "from"
+  bool inNodeId = false;  // Reading the value of "from"
+  uint64_t nodeId = 0;
+  char last = 0;  // Last character outside of strings
+  for (size_t i = 0; i < length; ++i) {
+    char c = data[i];
+    if (inString) {
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        inString = false;
+        if (depth == 1 && (last == '{' || last == ','))
+          fromKey = i - stringStart == 4 &&
+                    memcmp(data + stringStart, "from", 4) == 0;
+        last = c;
+        continue;
+      }
+      if (i - stringStart >= config.max_string_length)
+        return ValidationResult::STRING_TOO_LONG;
+      continue;
+    }
+    if (inNodeId) {
+      if (c >= '0' && c <= '9') {
+        nodeId = nodeId * 10 + (c - '0');
+        if (nodeId > 0xFFFFFFFF) return ValidationResult::INVALID_NODE_ID;
+        continue;
+      }
+      inNodeId = false;
+      if (nodeId < config.min_node_id || nodeId > config.max_node_id)
+        return ValidationResult::INVALID_NODE_ID;
+    }
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+    if (!started) {
+      if (c != '{') return ValidationResult::INVALID_JSON;
+      started = true;
+    } else if (depth == 0) {
+      // Anything after the top level object
+      return ValidationResult::INVALID_JSON;
+    }
+    if (fromKey && depth == 1 && last == ':') {
+      fromKey = false;
+      if (c < '0' || c > '9') return ValidationResult::INVALID_NODE_ID;
+      inNodeId = true;
+      nodeId = c - '0';
+    }
+    switch (c) {
+      case '{':
+      case '[':
+        if (++depth > config.max_nesting_depth)
+          return ValidationResult::NESTING_TOO_DEEP;
+        break;
+      case '}':
+      case ']':
+        --depth;
+        break;
+      case '"':
+        inString = true;
+        stringStart = i + 1;
+        continue;
+    }
+    last = c;
+  }
+  if (!started || inString || depth != 0) return ValidationResult::INVALID_JSON;
+  return ValidationResult::VALID;
+}
+
+/**
+ * Messages rejected by scanMessage(), per reason
+ */
+struct RejectionStats {
+  uint32_t tooLarge = 0;
+  uint32_t invalidJson = 0;
+  uint32_t tooDeep = 0;
+  uint32_t stringTooLong = 0;
+  uint32_t invalidNodeId = 0;
+  uint32_t rateLimited = 0;  // Origin was over its rate limit
+
+  void count(ValidationResult result) {
+    switch (result) {
+      case ValidationResult::MESSAGE_TOO_LARGE:
+        ++tooLarge;
+        break;
+      case ValidationResult::NESTING_TOO_DEEP:
+        ++tooDeep;
+        break;
+      case ValidationResult::STRING_TOO_LONG:
+        ++stringTooLong;
+        break;
+      case ValidationResult::INVALID_NODE_ID:
+        ++invalidNodeId;
+        break;
+      case ValidationResult::RATE_LIMIT_EXCEEDED:
+        ++rateLimited;
+        break;
+      default:
+        ++invalidJson;
+    }
+  }
+
+  void add(const RejectionStats& other) {
+    tooLarge += other.tooLarge;
+    invalidJson += other.invalidJson;
+    tooDeep += other.tooDeep;
+    stringTooLong += other.stringTooLong;
+    invalidNodeId += other.invalidNodeId;
+    rateLimited += other.rateLimited;
+  }
+
+  uint32_t total() const {
+    return tooLarge + invalidJson + tooDeep + stringTooLong + invalidNodeId +
+           rateLimited;
+  }
+};
+
 /**
  * Secure random number generation for mesh operations
  */